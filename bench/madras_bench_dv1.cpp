@@ -33,10 +33,12 @@ struct timespec print_time_taken(struct timespec t, const char *msg) {
 
 bool nodes_sorted_on_freq;
 madras_dv1::static_trie *bench_build(int argc, char *argv[], std::vector<uint8_t>& output_buf, std::vector<key_ctx>& lines,
-    bool is_sorted, int trie_count, size_t& trie_size, double& time_taken, double& keys_per_sec, bool as_int, int max_groups) {
+    bool is_sorted, int trie_count, size_t& trie_size, double& time_taken, double& keys_per_sec, bool as_int, int max_groups, int hot_region_size,
+    int thread_count) {
 
   int asc = argc > 4 ? atoi(argv[4]) : 0;
   int leapfrog = argc > 5 ? atoi(argv[5]) : 0;
+  bool sorted_build = argc > 9 ? (atoi(argv[9]) == 1 ? true : false) : false;
 
   struct timespec t;
   clock_gettime(CLOCK_REALTIME, &t);
@@ -48,6 +50,8 @@ madras_dv1::static_trie *bench_build(int argc, char *argv[], std::vector<uint8_t
   bldr_opts.max_groups = max_groups;
   bldr_opts.sort_nodes_on_freq = asc > 0 ? false : true;
   bldr_opts.leap_frog = leapfrog > 0 ? true : false;
+  bldr_opts.hot_region_size = hot_region_size;
+  bldr_opts.thread_count = thread_count;
   sb = new madras_dv1::builder(nullptr, "kv_table,Key", 1, "t", "u", 0, false, bldr_opts);
   sb->set_print_enabled(false);
 
@@ -63,10 +67,14 @@ madras_dv1::static_trie *bench_build(int argc, char *argv[], std::vector<uint8_t
       memcpy(lines[i].key, istr, isize);
       lines[i].key_len = isize;
     }
-    sb->insert(lines[i].key, lines[i].key_len, i);
+    if (sorted_build && is_sorted && !as_int)
+      sb->insert_sorted(lines[i].key, lines[i].key_len, i);
+    else
+      sb->insert(lines[i].key, lines[i].key_len, i);
   }
   //t = print_time_taken(t, "Time taken for insert/append: ");
 
+  output_buf.clear();
   sb->set_out_vec(&output_buf);
   sb->write_all(0);
 
@@ -127,6 +135,35 @@ bool bench_lookup(std::vector<key_ctx>& lines, madras_dv1::static_trie *trie_rea
 
 }
 
+// Checks lookup_batch against the leaf ids found by bench_lookup
+bool bench_lookup_batch(std::vector<key_ctx>& lines, madras_dv1::static_trie *trie_reader, double& time_taken, double& keys_per_sec) {
+
+  size_t line_count = lines.size();
+  std::vector<madras_dv1::input_ctx> in_ctxs(line_count);
+  for (size_t i = 0; i < line_count; i++) {
+    in_ctxs[i].key = lines[i].key;
+    in_ctxs[i].key_len = lines[i].key_len;
+  }
+
+  struct timespec t;
+  clock_gettime(CLOCK_REALTIME, &t);
+
+  size_t found_count = trie_reader->lookup_batch(in_ctxs.data(), line_count);
+
+  time_taken = time_taken_in_secs(t);
+  keys_per_sec = line_count / time_taken / 1000;
+
+  if (found_count != line_count)
+    return false;
+  for (size_t i = 0; i < line_count; i++) {
+    if (in_ctxs[i].cmp != 0 || trie_reader->leaf_rank1(in_ctxs[i].node_id) != lines[i].leaf_id)
+      return false;
+  }
+
+  return true;
+
+}
+
 bool bench_rev_lookup(std::vector<key_ctx>& lines, madras_dv1::static_trie *trie_reader, double& time_taken, double& keys_per_sec) {
 
   size_t out_key_len = 0;
@@ -181,10 +218,86 @@ bool bench_next(std::vector<key_ctx>& lines, madras_dv1::static_trie *trie_reade
 
 }
 
+// Round trip of a build with a hot region against one without:
+// every key is found and reverse looked up in both, and next()
+// lists the same keys in both
+bool check_hot_region(std::vector<key_ctx>& lines, madras_dv1::static_trie *hot_reader, madras_dv1::static_trie *ref_reader) {
+
+  size_t max_key_len = hot_reader->get_max_key_len();
+  if (ref_reader->get_max_key_len() != max_key_len)
+    return false;
+  size_t out_key_len = 0;
+  uint8_t out_key_buf[max_key_len + 1];
+  madras_dv1::input_ctx in_ctx;
+  madras_dv1::static_trie *readers[2] = {hot_reader, ref_reader};
+
+  key_ctx *kc;
+  size_t line_count = lines.size();
+  for (size_t i = 0; i < line_count; i++) {
+    kc = &lines[i];
+    for (int r = 0; r < 2; r++) {
+      in_ctx.key = kc->key;
+      in_ctx.key_len = kc->key_len;
+      if (!readers[r]->lookup(in_ctx))
+        return false;
+      uint32_t leaf_id = readers[r]->leaf_rank1(in_ctx.node_id);
+      if (!readers[r]->reverse_lookup(leaf_id, &out_key_len, out_key_buf))
+        return false;
+      if (kc->key_len != out_key_len || memcmp(kc->key, out_key_buf, kc->key_len) != 0)
+        return false;
+    }
+  }
+
+  if (nodes_sorted_on_freq)
+    return true;
+  uint8_t ref_key_buf[max_key_len + 1];
+  madras_dv1::iter_ctx hot_ctx, ref_ctx;
+  hot_ctx.init(max_key_len, hot_reader->get_max_level());
+  ref_ctx.init(max_key_len, ref_reader->get_max_level());
+  for (size_t i = 0; i < line_count; i++) {
+    out_key_len = hot_reader->next(hot_ctx, out_key_buf);
+    size_t ref_key_len = ref_reader->next(ref_ctx, ref_key_buf);
+    if (out_key_len != ref_key_len || memcmp(out_key_buf, ref_key_buf, out_key_len) != 0)
+      return false;
+  }
+
+  return true;
+
+}
+
+// Every key is found as the last of its own prefixes, as in marisa's prefix search
+bool bench_prefix_search(std::vector<key_ctx>& lines, madras_dv1::static_trie *trie_reader, double& time_taken, double& keys_per_sec) {
+
+  struct timespec t;
+  clock_gettime(CLOCK_REALTIME, &t);
+
+  key_ctx *kc;
+  size_t line_count = lines.size();
+  for (size_t i = 0; i < line_count; i++) {
+
+    kc = &lines[i];
+    uint32_t last_node_id = 0;
+    size_t last_len = 0;
+    trie_reader->common_prefix_search(kc->key, kc->key_len, [&](uint32_t node_id, size_t prefix_len) {
+      last_node_id = node_id;
+      last_len = prefix_len;
+      return true;
+    });
+    if (last_len != kc->key_len || trie_reader->leaf_rank1(last_node_id) != kc->leaf_id)
+      return false;
+
+  }
+  time_taken = time_taken_in_secs(t);
+  keys_per_sec = line_count / time_taken / 1000;
+
+  return true;
+
+}
+
 int main(int argc, char *argv[]) {
 
   if (argc < 2) {
-    printf("Usage: madras_bench <input_file> [min_inner_tries] [max_inner_tries] [asc] [leapfrog] [numbers] [max_groups]\n");
+    printf("Usage: madras_bench <input_file> [min_inner_tries] [max_inner_tries] [asc] [leapfrog] [numbers] [max_groups] [overlay_size] [sorted_build] [hot_region_size] [thread_count]\n");
     return 0;
   }
 
@@ -193,6 +306,9 @@ int main(int argc, char *argv[]) {
   // TODO: only 1 level works for as_int
   bool as_int = argc > 6 ? (atoi(argv[6]) == 1 ? true : false) : false;
   int max_groups = argc > 7 ? atoi(argv[7]) : 1;
+  int overlay_size = argc > 8 ? atoi(argv[8]) : 0;
+  int hot_region_size = argc > 10 ? atoi(argv[10]) : 0;
+  int thread_count = argc > 11 ? atoi(argv[11]) : 1;
 
   struct stat file_stat;
   memset(&file_stat, '\0', sizeof(file_stat));
@@ -258,18 +374,62 @@ int main(int argc, char *argv[]) {
   madras_dv1::static_trie *trie_reader;
 
   for (int i = min_inner_tries; i <= max_inner_tries; i++) {
-    trie_reader = bench_build(argc, argv, output_buf, lines, is_sorted, i, trie_size, time_taken, keys_per_sec, as_int, max_groups);
+    trie_reader = bench_build(argc, argv, output_buf, lines, is_sorted, i, trie_size, time_taken, keys_per_sec, as_int, max_groups, hot_region_size, thread_count);
     if (trie_size == 0) {
       printf("Build fail\n");
       return 1;
     }
+    // as_int keys are converted in place by the first build, so they are not rebuilt
+    if (hot_region_size > 0 && !as_int) {
+      std::vector<uint8_t> ref_buf;
+      size_t ref_size;
+      double ref_time, ref_kps;
+      madras_dv1::static_trie *ref_reader = bench_build(argc, argv, ref_buf, lines, is_sorted, i, ref_size, ref_time, ref_kps, as_int, max_groups, 0, thread_count);
+      bool is_same = check_hot_region(lines, trie_reader, ref_reader);
+      delete ref_reader;
+      if (!is_same) {
+        printf("Hot region check fail\n");
+        return 1;
+      }
+    }
+    // a threaded build has to give the same bytes as a single threaded one,
+    // use more than 65536 keys so that par_sort() splits the work
+    if (thread_count > 1 && !as_int) {
+      std::vector<uint8_t> ref_buf;
+      size_t ref_size;
+      double ref_time, ref_kps;
+      madras_dv1::static_trie *ref_reader = bench_build(argc, argv, ref_buf, lines, is_sorted, i, ref_size, ref_time, ref_kps, as_int, max_groups, hot_region_size, 1);
+      delete ref_reader;
+      if (ref_buf.size() != output_buf.size() || memcmp(ref_buf.data(), output_buf.data(), ref_buf.size()) != 0) {
+        printf("Thread build check fail\n");
+        return 1;
+      }
+    }
     printf("%lu\t%lf\t", trie_size, keys_per_sec);
+    madras_dv1::fwd_cache_overlay overlay;
+    if (overlay_size > 0) {
+      overlay.init(overlay_size);
+      trie_reader->set_fwd_cache_overlay(&overlay);
+      bench_lookup(lines, trie_reader, time_taken, keys_per_sec); // warm up
+      overlay.reset_counters();
+    }
     bool is_success = bench_lookup(lines, trie_reader, time_taken, keys_per_sec);
     if (!is_success) {
       printf("Lookup fail\n");
       return 1;
     }
     printf("%lf\t", keys_per_sec);
+    if (overlay_size > 0) {
+      printf("overlay hits: %llu, misses: %llu\t", (unsigned long long) overlay.get_hit_count(),
+          (unsigned long long) overlay.get_miss_count());
+      trie_reader->set_fwd_cache_overlay(nullptr);
+    }
+    is_success = bench_lookup_batch(lines, trie_reader, time_taken, keys_per_sec);
+    if (!is_success) {
+      printf("Batch lookup fail\n");
+      return 1;
+    }
+    printf("%lf\t", keys_per_sec);
     is_success = bench_rev_lookup(lines, trie_reader, time_taken, keys_per_sec);
     if (!is_success) {
       printf("Rev lookup fail\n");
@@ -282,9 +442,14 @@ int main(int argc, char *argv[]) {
         printf("Next fail\n");
         return 1;
       }
-      printf("%lf\n", keys_per_sec);
-    } else
-      printf("\n");
+      printf("%lf\t", keys_per_sec);
+    }
+    is_success = bench_prefix_search(lines, trie_reader, time_taken, keys_per_sec);
+    if (!is_success) {
+      printf("Prefix search fail\n");
+      return 1;
+    }
+    printf("%lf\n", keys_per_sec);
     delete trie_reader;
     output_buf.clear();
   }
@@ -0,0 +1,104 @@
+#include <iostream>
+#include <string>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "../src/madras_dv1.hpp"
+#include "../src/madras_builder_dv1.hpp"
+
+// Trains the fwd/rev caches of a key trie from a query log (one key per line)
+// and reports the projected fwd cache hit rate with and without the log
+
+uint8_t *read_file(const char *filename, size_t& file_size) {
+  struct stat file_stat;
+  memset(&file_stat, '\0', sizeof(file_stat));
+  stat(filename, &file_stat);
+  file_size = file_stat.st_size;
+  uint8_t *file_buf = new uint8_t[file_size + 1];
+  FILE *fp = fopen(filename, "rb");
+  if (fp == NULL) {
+    perror("Could not open file; ");
+    delete [] file_buf;
+    return NULL;
+  }
+  size_t res = fread(file_buf, 1, file_size, fp);
+  fclose(fp);
+  if (res != file_size) {
+    perror("Error reading file: ");
+    delete [] file_buf;
+    return NULL;
+  }
+  return file_buf;
+}
+
+void split_lines(uint8_t *file_buf, size_t file_size, std::vector<std::pair<uint8_t *, int> >& lines) {
+  size_t line_len = 0;
+  uint8_t *line = gen::extract_line(file_buf, line_len, file_size);
+  while (line != NULL) {
+    lines.push_back(std::pair<uint8_t *, int>(line, (int) line_len));
+    line = gen::extract_line(line, line_len, file_size - (line - file_buf) - line_len);
+  }
+}
+
+madras_dv1::builder *build(std::vector<std::pair<uint8_t *, int> >& keys, std::vector<std::pair<uint8_t *, int> > *queries,
+        std::vector<uint8_t>& output_buf, const char *out_file) {
+  madras_dv1::builder *sb = new madras_dv1::builder(out_file, "kv_table,Key", 1, "t", "u", 0, 1, madras_dv1::dflt_opts);
+  sb->set_print_enabled(false);
+  for (size_t i = 0; i < keys.size(); i++)
+    sb->insert(keys[i].first, keys[i].second, i);
+  if (queries != NULL) {
+    for (size_t i = 0; i < queries->size(); i++)
+      sb->add_ns_profile((*queries)[i].first, (*queries)[i].second);
+  }
+  if (out_file == NULL)
+    sb->set_out_vec(&output_buf);
+  sb->write_all(0);
+  return sb;
+}
+
+double projected_hit_rate(madras_dv1::builder *sb, std::vector<std::pair<uint8_t *, int> >& queries) {
+  uint64_t hit_count = 0;
+  uint64_t step_count = 0;
+  for (size_t i = 0; i < queries.size(); i++)
+    sb->replay_fwd_cache(queries[i].first, queries[i].second, hit_count, step_count);
+  printf("Fwd cache hits: %llu, transitions: %llu\n", (unsigned long long) hit_count, (unsigned long long) step_count);
+  return step_count == 0 ? 0 : hit_count * 100.0 / step_count;
+}
+
+int main(int argc, char *argv[]) {
+
+  if (argc < 3) {
+    printf("Usage: madras_cache_train <key_file> <query_log> [out_file]\n");
+    return 0;
+  }
+
+  size_t key_file_size, query_file_size;
+  uint8_t *key_buf = read_file(argv[1], key_file_size);
+  uint8_t *query_buf = read_file(argv[2], query_file_size);
+  if (key_buf == NULL || query_buf == NULL)
+    return 1;
+
+  std::vector<std::pair<uint8_t *, int> > keys;
+  std::vector<std::pair<uint8_t *, int> > queries;
+  split_lines(key_buf, key_file_size, keys);
+  split_lines(query_buf, query_file_size, queries);
+  printf("Keys: %lu, queries: %lu\n", keys.size(), queries.size());
+
+  std::vector<uint8_t> output_buf;
+  madras_dv1::builder *sb = build(keys, NULL, output_buf, NULL);
+  double hit_rate_before = projected_hit_rate(sb, queries);
+  delete sb;
+
+  output_buf.clear();
+  sb = build(keys, &queries, output_buf, argc > 3 ? argv[3] : NULL);
+  double hit_rate_after = projected_hit_rate(sb, queries);
+  delete sb;
+
+  printf("Projected fwd cache hit rate, static counts: %.2lf%%, query log: %.2lf%%\n", hit_rate_before, hit_rate_after);
+
+  delete [] key_buf;
+  delete [] query_buf;
+
+  return 0;
+
+}
@@ -0,0 +1,112 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../src/madras_dv1.hpp"
+#include "../src/madras_builder_dv1.hpp"
+
+// Builds an MSE_DICT_DELTA column with and without keys and checks that
+// next_col_val() from the first row, next_col_val() from rows in the middle of
+// checkpoint sub blocks, decode_range() and get_col_val() all give the values
+// inserted, row by row.
+
+int64_t make_val(size_t row) {
+  return (int64_t) ((row * 7919) % 1000) - 500 + (int64_t) (row / 3);
+}
+
+void build_delta_col(const char *out_file, size_t row_count, int pk_col_count) {
+  char key[17];
+  uint64_t values[2];
+  size_t value_lens[2];
+  values[0] = (uint64_t) key;
+  value_lens[1] = 8;
+  madras_dv1::builder *sb = new madras_dv1::builder(out_file, "delta_tbl,key,qty", 2,
+      "ti", "ud", 0, pk_col_count, madras_dv1::dflt_opts);
+  sb->set_print_enabled(false);
+  for (size_t i = 0; i < row_count; i++) {
+    // keys in insertion order, so that leaf ids are row numbers
+    snprintf(key, sizeof(key), "k%08lu", (unsigned long) i);
+    value_lens[0] = strlen(key);
+    values[1] = (uint64_t) make_val(i);
+    sb->insert(values, value_lens);
+  }
+  sb->write_all();
+  delete sb;
+}
+
+size_t check_delta_col(const char *out_file, size_t row_count) {
+  madras_dv1::static_trie_map trie;
+  trie.load(out_file);
+  bool has_keys = (trie.get_key_count() > 0);
+  size_t trie_rows = has_keys ? trie.get_key_count() : trie.get_node_count();
+  if (trie_rows != row_count) {
+    printf("Row count: %lu, expected: %lu\n", trie_rows, row_count);
+    return 1;
+  }
+  size_t err_count = 0;
+  int64_t i64;
+  size_t val_len;
+
+  // from the first row, no checkpoints involved
+  madras_dv1::col_iter_ctx ctx;
+  trie.init_col_iter(1, 0, ctx);
+  size_t row = 0;
+  while (trie.next_col_val(ctx, &val_len, &i64)) {
+    if (row >= row_count || val_len != 8 || i64 != make_val(row))
+      err_count++;
+    row++;
+  }
+  if (row != row_count)
+    err_count++;
+  printf("next_col_val errors: %lu\n", err_count);
+
+  // from rows on both sides of checkpoint sub block boundaries
+  for (size_t start = 0; start < row_count; start += 997) {
+    trie.init_col_iter(1, start, ctx);
+    for (row = start; row < start + 70 && row < row_count; row++) {
+      if (!trie.next_col_val(ctx, &val_len, &i64) || i64 != make_val(row))
+        err_count++;
+    }
+  }
+  printf("next_col_val with seek errors: %lu\n", err_count);
+
+  const uint32_t block_size = 4096;
+  int64_t vals[block_size];
+  for (row = 0; row < row_count; row += block_size) {
+    uint32_t count = trie.decode_range(1, row, block_size, vals);
+    if (count != (row_count - row < block_size ? row_count - row : block_size))
+      err_count++;
+    for (uint32_t i = 0; i < count; i++) {
+      if (vals[i] != make_val(row + i))
+        err_count++;
+    }
+  }
+  printf("decode_range errors: %lu\n", err_count);
+
+  for (row = 0; row < row_count; row++) {
+    uint32_t node_id = has_keys ? trie.leaf_select1(row + 1) - 1 : row;
+    val_len = 8;
+    if (!trie.get_col_val(node_id, 1, &val_len, &i64) || i64 != make_val(row))
+      err_count++;
+  }
+  printf("get_col_val errors: %lu\n", err_count);
+  return err_count;
+}
+
+int main(int argc, char *argv[]) {
+
+  size_t row_count = argc > 1 ? atol(argv[1]) : 300000;
+  const char *out_file = argc > 2 ? argv[2] : "/tmp/mdx_delta_col.mdx";
+
+  size_t err_count = 0;
+  for (int pk_col_count = 0; pk_col_count <= 1; pk_col_count++) {
+    printf("Primary key columns: %d\n", pk_col_count);
+    build_delta_col(out_file, row_count, pk_col_count);
+    err_count += check_delta_col(out_file, row_count);
+  }
+  if (err_count > 0)
+    printf("Delta column check fail\n");
+
+  return err_count > 0 ? 1 : 0;
+
+}
@@ -0,0 +1,143 @@
+#include <iostream>
+#include <string>
+#include <sys/resource.h>
+
+#include "../src/madras_dv1.hpp"
+#include "../src/madras_builder_dv1.hpp"
+
+// Builds a table with set_mem_budget() and checks that peak RSS stays
+// within the budget plus the per key structures (memtrie, row positions
+// and one column of values) instead of growing with the record size.
+// Every 1000th key is inserted again later, alternately shorter and longer,
+// and the result must match a build of the same rows without a budget.
+
+#define EXT_COL_COUNT 7
+#define EXT_VAL_LEN 120
+
+long get_peak_rss_kb() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+  return usage.ru_maxrss;
+}
+
+void make_row(size_t row, uint32_t variant, char *key, char vals[][EXT_VAL_LEN + 9], size_t *value_lens) {
+  uint64_t h = (row + 1) * 0x9E3779B97F4A7C15ULL;
+  snprintf(key, 17, "%016llx", (unsigned long long) h);
+  // variant 1 is shorter and variant 2 longer than the first record
+  size_t val_len = EXT_VAL_LEN + (variant == 1 ? -8 : (variant == 2 ? 8 : 0));
+  for (int c = 0; c < EXT_COL_COUNT - 1; c++) {
+    for (size_t i = 0; i < val_len; i++)
+      vals[c][i] = 'a' + ((h >> ((i + c) % 60)) + i + variant) % 26;
+    vals[c][val_len] = 0;
+    value_lens[c + 1] = val_len;
+  }
+}
+
+void build_rows(const char *out_file, size_t row_count, size_t budget) {
+  char key[17];
+  char vals[EXT_COL_COUNT - 1][EXT_VAL_LEN + 9];
+  uint64_t values[EXT_COL_COUNT];
+  size_t value_lens[EXT_COL_COUNT];
+  values[0] = (uint64_t) key;
+  value_lens[0] = 16;
+  for (int c = 1; c < EXT_COL_COUNT; c++)
+    values[c] = (uint64_t) vals[c - 1];
+  madras_dv1::builder *sb = new madras_dv1::builder(out_file, "ext_tbl,key,c1,c2,c3,c4,c5,c6", EXT_COL_COUNT,
+      "ttttttt", "uuuuuuu", 0, 1, madras_dv1::dflt_opts);
+  sb->set_print_enabled(false);
+  sb->set_mem_budget(budget);
+  for (size_t i = 0; i < row_count; i++) {
+    make_row(i, 0, key, vals, value_lens);
+    sb->insert(values, value_lens);
+    if (i >= 1000 && (i % 1000) == 0) {
+      make_row(i - 1000, (i / 1000) % 2 + 1, key, vals, value_lens);
+      sb->insert(values, value_lens);
+    }
+  }
+  sb->write_all();
+  delete sb;
+}
+
+// Compares the keys and all column values of two tries, in key order
+size_t compare_tries(madras_dv1::static_trie_map& trie, madras_dv1::static_trie_map& ref_trie) {
+  size_t err_count = 0;
+  madras_dv1::iter_ctx ctx, ref_ctx;
+  ctx.init(trie.get_max_key_len(), trie.get_max_level());
+  ref_ctx.init(ref_trie.get_max_key_len(), ref_trie.get_max_level());
+  uint8_t key_buf[trie.get_max_key_len() + 1];
+  uint8_t ref_key_buf[ref_trie.get_max_key_len() + 1];
+  uint8_t val_buf[EXT_VAL_LEN + 32];
+  uint8_t ref_val_buf[EXT_VAL_LEN + 32];
+  madras_dv1::input_ctx in_ctx;
+  while (1) {
+    int key_len = trie.next(ctx, key_buf);
+    int ref_key_len = ref_trie.next(ref_ctx, ref_key_buf);
+    if (key_len != ref_key_len || (key_len > 0 && memcmp(key_buf, ref_key_buf, key_len) != 0)) {
+      err_count++;
+      break;
+    }
+    if (key_len == -2)
+      break;
+    in_ctx.key = key_buf;
+    in_ctx.key_len = key_len;
+    if (!trie.lookup(in_ctx)) {
+      err_count++;
+      continue;
+    }
+    uint32_t node_id = in_ctx.node_id;
+    in_ctx.key = ref_key_buf;
+    if (!ref_trie.lookup(in_ctx)) {
+      err_count++;
+      continue;
+    }
+    for (int c = 1; c < EXT_COL_COUNT; c++) {
+      size_t val_len = sizeof(val_buf);
+      size_t ref_val_len = sizeof(ref_val_buf);
+      trie.get_col_val(node_id, c, &val_len, val_buf);
+      ref_trie.get_col_val(in_ctx.node_id, c, &ref_val_len, ref_val_buf);
+      if (val_len != ref_val_len || memcmp(val_buf, ref_val_buf, val_len) != 0)
+        err_count++;
+    }
+  }
+  return err_count;
+}
+
+int main(int argc, char *argv[]) {
+
+  size_t row_count = argc > 1 ? atol(argv[1]) : 500000;
+  size_t budget = (argc > 2 ? atol(argv[2]) : 16) << 20;
+  const char *out_file = argc > 3 ? argv[3] : "/tmp/mdx_ext_sort.mdx";
+
+  long base_rss_kb = get_peak_rss_kb();
+  build_rows(out_file, row_count, budget);
+  long growth_kb = get_peak_rss_kb() - base_rss_kb;
+
+  size_t rec_bytes = row_count * (16 + (EXT_COL_COUNT - 1) * (EXT_VAL_LEN + 1));
+  size_t limit = budget + row_count * (16 + EXT_VAL_LEN) * 4;
+  printf("Rows: %lu, record bytes: %lu, budget: %lu, peak RSS growth: %ld KB, limit: %lu KB\n",
+      row_count, rec_bytes, budget, growth_kb, limit / 1024);
+  if (limit >= rec_bytes)
+    printf("Warning: limit is not below the record bytes, use more rows\n");
+  bool is_success = ((size_t) growth_kb * 1024 <= limit);
+  if (!is_success)
+    printf("Peak RSS above limit\n");
+
+  // same rows in memory, after the peak RSS of the budgeted build is taken
+  std::string ref_file = std::string(out_file) + ".ref";
+  build_rows(ref_file.c_str(), row_count, 0);
+  madras_dv1::static_trie_map trie;
+  trie.load(out_file);
+  madras_dv1::static_trie_map ref_trie;
+  ref_trie.load(ref_file.c_str());
+  size_t err_count = 0;
+  if (trie.get_key_count() != ref_trie.get_key_count())
+    err_count++;
+  err_count += compare_tries(trie, ref_trie);
+  printf("Value errors: %lu\n", err_count);
+  if (err_count > 0)
+    is_success = false;
+
+  return is_success ? 0 : 1;
+
+}
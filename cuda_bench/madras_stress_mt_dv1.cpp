@@ -0,0 +1,274 @@
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <deque>
+#include <future>
+#include <functional>
+#include <string>
+
+#include "common_mt_dv1.hpp"
+#include "../src/madras_dv1.hpp"
+
+// Runs lookup, reverse_lookup, get_col_val and next() from many threads
+// against one shared static_trie_map and compares every result with a
+// single threaded pass, which also checks count_prefix(), lower_bound(),
+// upper_bound() and range(). With reload_count > 0 the main thread keeps replacing
+// the trie through a trie_handle while the others query it.
+// Build with `make -f Makefile_mt_bench tsan` to check for races, or run
+// `make -f Makefile_mt_bench tsan_overlay MDX=<mdx_file>` to check them with a
+// shared fwd_cache_overlay and reloads.
+
+struct key_result {
+  std::string key;
+  uint32_t node_id;
+  uint64_t val_hash;
+};
+
+uint64_t hash_bytes(uint64_t h, const uint8_t *bytes, size_t len) {
+  for (size_t i = 0; i < len; i++)
+    h = (h ^ bytes[i]) * 1099511628211ULL;
+  return h;
+}
+
+uint64_t hash_col_vals(madras_dv1::static_trie_map *trie, uint32_t node_id, uint8_t *val_buf) {
+  uint64_t h = 14695981039346656037ULL;
+  for (int col = 0; col < trie->get_column_count(); col++) {
+    size_t val_len = trie->get_max_val_len() + 16;
+    trie->get_col_val(node_id, col, &val_len, val_buf);
+    h = hash_bytes(h, val_buf, val_len);
+  }
+  return h;
+}
+
+size_t check_range(size_t start, size_t end, std::vector<key_result> *expected, madras_dv1::trie_handle *handle, int rounds) {
+  size_t err_count = 0;
+  int slot = handle->register_reader();
+  if (slot < 0) {
+    printf("No reader slot left\n");
+    return 1;
+  }
+  madras_dv1::static_trie_map *trie = handle->acquire(slot);
+  uint8_t key_buf[trie->get_max_key_len() + 1];
+  uint8_t val_buf[trie->get_max_val_len() + 16];
+  handle->release(slot);
+  madras_dv1::input_ctx in_ctx;
+  for (int r = 0; r < rounds; r++) {
+    trie = handle->acquire(slot);
+    for (size_t i = start; i < end; i++) {
+      key_result *kr = &(*expected)[i];
+      in_ctx.key = (const uint8_t *) kr->key.data();
+      in_ctx.key_len = kr->key.size();
+      if (!trie->lookup(in_ctx) || in_ctx.node_id != kr->node_id) {
+        err_count++;
+        continue;
+      }
+      size_t out_key_len;
+      trie->reverse_lookup(trie->leaf_rank1(in_ctx.node_id), &out_key_len, key_buf);
+      if (out_key_len != kr->key.size() || memcmp(key_buf, kr->key.data(), out_key_len) != 0)
+        err_count++;
+      if (hash_col_vals(trie, in_ctx.node_id, val_buf) != kr->val_hash)
+        err_count++;
+    }
+    // each thread iterates with its own context
+    madras_dv1::iter_ctx ctx;
+    ctx.init(trie->get_max_key_len(), trie->get_max_level());
+    for (size_t i = 0; i < expected->size() && i < (end - start); i++) {
+      int key_len = trie->next(ctx, key_buf);
+      key_result *kr = &(*expected)[i];
+      if (key_len != (int) kr->key.size() || memcmp(key_buf, kr->key.data(), key_len) != 0) {
+        err_count++;
+        break;
+      }
+    }
+    handle->release(slot);
+  }
+  handle->unregister_reader(slot);
+  return err_count;
+}
+
+bool key_lt(const key_result& kr, const std::string& key) {
+  return kr.key < key;
+}
+
+bool key_gt(const std::string& key, const key_result& kr) {
+  return key < kr.key;
+}
+
+size_t check_next(madras_dv1::static_trie_map& trie, std::vector<key_result>& expected, size_t pos,
+        madras_dv1::iter_ctx& ctx, uint8_t *key_buf) {
+  int key_len = trie.next(ctx, key_buf);
+  if (pos == expected.size())
+    return key_len == -2 ? 0 : 1;
+  const std::string& key = expected[pos].key;
+  return (key_len == (int) key.size() && memcmp(key_buf, key.data(), key_len) == 0) ? 0 : 1;
+}
+
+// Checks lower_bound(), upper_bound() and range() with key, which need not be in
+// the trie, against its position in expected, which holds the first keys in order
+// and all of them if is_complete
+size_t check_seek(madras_dv1::static_trie_map& trie, std::vector<key_result>& expected, bool is_complete,
+        const std::string& key, const std::string& hi_key, uint8_t *key_buf) {
+  size_t err_count = 0;
+  size_t lo_pos = std::lower_bound(expected.begin(), expected.end(), key, key_lt) - expected.begin();
+  size_t gt_pos = std::upper_bound(expected.begin(), expected.end(), key, key_gt) - expected.begin();
+  size_t hi_pos = std::lower_bound(expected.begin(), expected.end(), hi_key, key_lt) - expected.begin();
+  madras_dv1::iter_ctx ctx;
+  if (lo_pos < expected.size() || is_complete) {
+    if (trie.lower_bound((const uint8_t *) key.data(), key.size(), ctx) != 0)
+      err_count++;
+    else
+      err_count += check_next(trie, expected, lo_pos, ctx, key_buf);
+  }
+  if (gt_pos < expected.size() || is_complete) {
+    if (trie.upper_bound((const uint8_t *) key.data(), key.size(), ctx) != 0)
+      err_count++;
+    else
+      err_count += check_next(trie, expected, gt_pos, ctx, key_buf);
+  }
+  if ((lo_pos < expected.size() && hi_pos < expected.size()) || is_complete) {
+    uint32_t from_pos, to_pos;
+    uint32_t count = trie.range((const uint8_t *) key.data(), key.size(),
+                        (const uint8_t *) hi_key.data(), hi_key.size(), from_pos, to_pos);
+    size_t expected_count = (hi_pos > lo_pos ? hi_pos - lo_pos : 0);
+    if (count != expected_count || from_pos != lo_pos)
+      err_count++;
+  }
+  return err_count;
+}
+
+int main(int argc, const char *argv[]) {
+
+  if (argc < 3) {
+    printf("Usage: mt_stress <mdx_file> <num_threads> [rounds] [max_keys] [overlay_size] [reload_count]\n");
+    return 1;
+  }
+
+  int num_threads = atoi(argv[2]);
+  int rounds = argc > 3 ? atoi(argv[3]) : 4;
+  size_t max_keys = argc > 4 ? atol(argv[4]) : 1000000;
+  int overlay_size = argc > 5 ? atoi(argv[5]) : 0;
+  int reload_count = argc > 6 ? atoi(argv[6]) : 0;
+
+  // one overlay per published trie, outliving the handle
+  std::deque<madras_dv1::fwd_cache_overlay> overlays;
+  madras_dv1::trie_handle handle;
+  madras_dv1::static_trie_map *new_trie = new madras_dv1::static_trie_map();
+  if (!new_trie->map_file_to_mem(argv[1]))
+    return 1;
+  if (overlay_size > 0) {
+    overlays.emplace_back();
+    overlays.back().init(overlay_size);
+    new_trie->set_fwd_cache_overlay(&overlays.back());
+  }
+  handle.publish(new_trie);
+  madras_dv1::static_trie_map& trie = *new_trie;
+
+  struct timespec t;
+  clock_gettime(CLOCK_REALTIME, &t);
+
+  std::vector<key_result> expected;
+  uint8_t key_buf[trie.get_max_key_len() + 1];
+  uint8_t val_buf[trie.get_max_val_len() + 16];
+  madras_dv1::iter_ctx ctx;
+  ctx.init(trie.get_max_key_len(), trie.get_max_level());
+  madras_dv1::input_ctx in_ctx;
+  while (expected.size() < max_keys) {
+    int key_len = trie.next(ctx, key_buf);
+    if (key_len == -2)
+      break;
+    key_result kr;
+    kr.key.assign((const char *) key_buf, key_len);
+    in_ctx.key = (const uint8_t *) kr.key.data();
+    in_ctx.key_len = kr.key.size();
+    trie.lookup(in_ctx);
+    kr.node_id = in_ctx.node_id;
+    kr.val_hash = hash_col_vals(&trie, in_ctx.node_id, val_buf);
+    expected.push_back(kr);
+  }
+  printf("Keys: %lu, columns: %d\n", expected.size(), trie.get_column_count());
+  t = print_time_taken(t, "Time taken for single threaded pass: ");
+
+  // keys come in order, so the keys sharing a prefix are one run of expected
+  size_t err_count = 0;
+  for (size_t i = 0; i < expected.size(); i += 97) {
+    std::string prefix = expected[i].key.substr(0, (expected[i].key.size() + 1) / 2);
+    size_t from = i;
+    size_t to = i + 1;
+    while (from > 0 && expected[from - 1].key.compare(0, prefix.size(), prefix) == 0)
+      from--;
+    while (to < expected.size() && expected[to].key.compare(0, prefix.size(), prefix) == 0)
+      to++;
+    if (to == expected.size() && expected.size() == max_keys)
+      continue;
+    if (trie.count_prefix((const uint8_t *) prefix.data(), prefix.size()) != to - from)
+      err_count++;
+  }
+  t = print_time_taken(t, "Time taken for count_prefix: ");
+
+  // lower_bound/upper_bound land on the first key >= and > the probe, for keys
+  // in the trie, keys between neighbours, before the first, after the last and
+  // the empty key. They fail when node sets are sorted on frequency.
+  madras_dv1::iter_ctx seek_ctx;
+  bool is_complete = (expected.size() < max_keys);
+  if (trie.lower_bound(key_buf, 0, seek_ctx) == -2) {
+    uint32_t from_pos, to_pos;
+    if (trie.upper_bound(key_buf, 0, seek_ctx) != -2 || trie.range(key_buf, 0, key_buf, 0, from_pos, to_pos) != UINT32_MAX)
+      err_count++;
+  } else if (expected.size() > 0) {
+    std::vector<std::string> probes;
+    probes.push_back(std::string());
+    const std::string& first_key = expected[0].key;
+    if (first_key.size() > 0 && (uint8_t) first_key[0] > 0)
+      probes.push_back(std::string(1, first_key[0] - 1));
+    if (is_complete)
+      probes.push_back(expected.back().key + "\xFF\xFF");
+    for (size_t i = 0; i + 1 < expected.size(); i += 89) {
+      const std::string& key = expected[i].key;
+      probes.push_back(key);
+      probes.push_back(key + '\0');
+      if (key.size() > 0 && (uint8_t) key[key.size() - 1] < 0xFF)
+        probes.push_back(key.substr(0, key.size() - 1) + (char) (key[key.size() - 1] + 1));
+    }
+    for (size_t i = 0; i < probes.size(); i++)
+      err_count += check_seek(trie, expected, is_complete, probes[i], probes[(i + 7) % probes.size()], key_buf);
+  }
+  t = print_time_taken(t, "Time taken for lower_bound/upper_bound/range: ");
+
+  size_t keys_per_thread = (expected.size() + num_threads - 1) / num_threads;
+  std::vector<std::future<size_t> > futures;
+  for (int i = 0; i < num_threads; i++) {
+    // ranges overlap so that threads touch the same nodes and columns
+    size_t start = (i * keys_per_thread) / 2;
+    size_t end = min_of(start + keys_per_thread, expected.size());
+    futures.push_back(std::async(std::launch::async, check_range, start, end, &expected, &handle, rounds));
+  }
+  for (int i = 0; i < reload_count; i++) {
+    new_trie = new madras_dv1::static_trie_map();
+    if (!new_trie->map_file_to_mem(argv[1]))
+      return 1;
+    if (overlay_size > 0) {
+      overlays.emplace_back();
+      overlays.back().init(overlay_size);
+      new_trie->set_fwd_cache_overlay(&overlays.back());
+    }
+    handle.publish(new_trie);
+  }
+  for (size_t i = 0; i < futures.size(); i++)
+    err_count += futures[i].get();
+
+  handle.synchronize();
+  t = print_time_taken(t, "Time taken for multi threaded pass: ");
+  if (overlay_size > 0) {
+    uint64_t hit_count = 0;
+    uint64_t miss_count = 0;
+    for (size_t i = 0; i < overlays.size(); i++) {
+      hit_count += overlays[i].get_hit_count();
+      miss_count += overlays[i].get_miss_count();
+    }
+    printf("Overlay hits: %lu, misses: %lu\n", (unsigned long) hit_count, (unsigned long) miss_count);
+  }
+  printf("Errors: %lu\n", err_count);
+
+  return err_count == 0 ? 0 : 1;
+
+}
@@ -1,4 +1,6 @@
 #include <cstring>
+#include <vector>
+#include <algorithm>
 #include <stdio.h>
 #include <stdint.h>
 #include <sys/stat.h>
@@ -19,7 +21,7 @@ clock_t print_time_taken(clock_t t, const char *msg) {
 int main(int argc, char *argv[]) {
 
   if (argc < 3) {
-    printf("Usage: query_mdx <mdx_file> <column_index>");
+    printf("Usage: query_mdx <mdx_file> <column_index> [lo hi | text_value [text_value2]]\n");
     return 0;
   }
 
@@ -34,8 +36,6 @@ int main(int argc, char *argv[]) {
 
   int column_idx = atoi(argv[2]);
 
-  uint8_t col_val[20];
-  size_t col_len = 0;
   uint32_t ptr_bit_count = UINT32_MAX;
 
   int row_count = dict_reader.get_key_count();
@@ -53,30 +53,155 @@ int main(int argc, char *argv[]) {
     //uint8_t val[1000]; // get_max_val_len not working for trie columns
     size_t val_len;
     int64_t sum = 0;
+    // values for the filters, the second one only used by filter_in
+    const uint8_t *in_vals[2];
+    size_t in_val_lens[2];
+    if (argc > 3) {
+      in_vals[0] = (const uint8_t *) argv[3];
+      in_vals[1] = (const uint8_t *) (argc > 4 ? argv[4] : argv[3]);
+      in_val_lens[0] = strlen((const char *) in_vals[0]);
+      in_val_lens[1] = strlen((const char *) in_vals[1]);
+    }
+    uint32_t eq_count = 0;
+    uint32_t prefix_count = 0;
+    uint32_t in_count = 0;
     for (size_t i = 0; i < row_count; i++) {
       bool is_success = dict_reader.get_col_val(i, column_idx, &val_len, val, &ptr_bit_count);
-      if (is_success && val_len != -1)
+      if (is_success && val_len != -1) {
         sum += val_len;
+        if (argc > 3) {
+          if (val_len >= in_val_lens[0] && memcmp(val, in_vals[0], in_val_lens[0]) == 0) {
+            prefix_count++;
+            if (val_len == in_val_lens[0])
+              eq_count++;
+          }
+          for (int j = 0; j < 2; j++) {
+            if (val_len == in_val_lens[j] && memcmp(val, in_vals[j], val_len) == 0) {
+              in_count++;
+              break;
+            }
+          }
+        }
+      }
     }
     printf("Sum: %lld\n", sum);
-  } else
-  if (data_type == '0' || data_type == 'i') {
-    int64_t sum = 0;
-    for (int i = 0; i < row_count; i++) {
-      bool is_success = dict_reader.get_col_val(i, column_idx, &col_len, col_val, &ptr_bit_count);
-      if (is_success && col_len != -1)
-        sum += *((int64_t *) col_val);
+    if (argc > 3) {
+      t = print_time_taken(t, "Time taken for sum: ");
+      // rows matching the given values, a block of rows at a time,
+      // checked against the values read by get_col_val()
+      const uint32_t block_size = 4096;
+      uint32_t sel_vec[block_size];
+      uint32_t match_count = 0;
+      madras_dv1::filter_memo memo;
+      // rows of filter_eq and filter_prefix kept to check the posting lists
+      std::vector<uint32_t> eq_rows;
+      std::vector<uint32_t> prefix_rows;
+      uint32_t count;
+      for (uint32_t row = 0; row < (uint32_t) row_count; row += count) {
+        count = row_count - row < block_size ? row_count - row : block_size;
+        uint32_t sel_count = dict_reader.filter_eq(column_idx, in_vals[0], in_val_lens[0], sel_vec, row, count, &memo);
+        eq_rows.insert(eq_rows.end(), sel_vec, sel_vec + sel_count);
+        match_count += sel_count;
+      }
+      printf("Where = %s - count: %u\n", argv[3], match_count);
+      t = print_time_taken(t, "Time taken for filter_eq: ");
+      bool is_same = (match_count == eq_count);
+      memo.reset();
+      match_count = 0;
+      for (uint32_t row = 0; row < (uint32_t) row_count; row += count) {
+        count = row_count - row < block_size ? row_count - row : block_size;
+        uint32_t sel_count = dict_reader.filter_prefix(column_idx, in_vals[0], in_val_lens[0], sel_vec, row, count, &memo);
+        prefix_rows.insert(prefix_rows.end(), sel_vec, sel_vec + sel_count);
+        match_count += sel_count;
+      }
+      printf("Where like %s%% - count: %u\n", argv[3], match_count);
+      t = print_time_taken(t, "Time taken for filter_prefix: ");
+      is_same = is_same && (match_count == prefix_count);
+      memo.reset();
+      match_count = 0;
+      for (uint32_t row = 0; row < (uint32_t) row_count; row += count) {
+        count = row_count - row < block_size ? row_count - row : block_size;
+        match_count += dict_reader.filter_in(column_idx, in_vals, in_val_lens, 2, sel_vec, row, count, &memo);
+      }
+      printf("Where in (%s, %s) - count: %u\n", in_vals[0], in_vals[1], match_count);
+      t = print_time_taken(t, "Time taken for filter_in: ");
+      is_same = is_same && (match_count == in_count);
+      if (!is_same) {
+        printf("Filter counts differ from get_col_val - eq: %u, prefix: %u, in: %u\n", eq_count, prefix_count, in_count);
+        return 2;
+      }
+      if (dict_reader.get_column_encoding(column_idx) == MSE_TRIE_2WAY) {
+        // the posting lists should give the same rows as the filters
+        std::vector<uint32_t> post_rows(eq_rows.size() + 1);
+        match_count = dict_reader.get_value_rows(column_idx, in_vals[0], in_val_lens[0], post_rows.data(), eq_rows.size());
+        printf("Postings count: %u\n", match_count);
+        t = print_time_taken(t, "Time taken for get_value_rows: ");
+        post_rows.resize(match_count < eq_rows.size() ? match_count : eq_rows.size());
+        if (match_count != eq_rows.size() || post_rows != eq_rows) {
+          printf("get_value_rows differs from filter_eq\n");
+          return 2;
+        }
+        post_rows.resize(prefix_rows.size() + 1);
+        match_count = dict_reader.get_prefix_rows(column_idx, in_vals[0], in_val_lens[0], post_rows.data(), prefix_rows.size());
+        printf("Prefix postings count: %u\n", match_count);
+        t = print_time_taken(t, "Time taken for get_prefix_rows: ");
+        post_rows.resize(match_count < prefix_rows.size() ? match_count : prefix_rows.size());
+        // rows are sorted only within a value
+        std::sort(post_rows.begin(), post_rows.end());
+        if (match_count != prefix_rows.size() || post_rows != prefix_rows) {
+          printf("get_prefix_rows differs from filter_prefix\n");
+          return 2;
+        }
+      }
+      return 1;
     }
-    printf("Sum: %lld\n", sum);
   } else {
-    double sum = 0;
-    for (int i = 0; i < row_count; i++) {
-      *((double *) col_val) = 0;
-      bool is_success = dict_reader.get_col_val(i, column_idx, &col_len, col_val, &ptr_bit_count);
-      if (is_success && col_len != -1)
-        sum += *((double *) col_val);
+    // numeric columns are decoded a block of rows at a time
+    const uint32_t block_size = 4096;
+    int64_t vals[block_size];
+    uint64_t null_bm[block_size / 64];
+    bool is_dec = (data_type >= '0' && data_type <= '9');
+    int64_t sum = 0;
+    double dbl_sum = 0;
+    for (uint32_t row = 0; row < (uint32_t) row_count; row += block_size) {
+      uint32_t count = dict_reader.decode_range(column_idx, row, block_size, vals, null_bm);
+      if (is_dec) {
+        double *dbl_vals = (double *) vals;
+        for (uint32_t i = 0; i < count; i++)
+          dbl_sum += dbl_vals[i];
+      } else {
+        for (uint32_t i = 0; i < count; i++)
+          sum += vals[i];
+      }
     }
-    printf("Sum: %lf\n", sum);
+    if (is_dec)
+      printf("Sum: %lf\n", dbl_sum);
+    else
+      printf("Sum: %lld\n", (long long) sum);
+    t = print_time_taken(t, "Time taken for sum: ");
+
+    madras_dv1::col_agg agg;
+    agg.reset(data_type); // also used below to scale the scan_where sum
+    if (dict_reader.aggregate(column_idx, agg)) {
+      printf("Aggregate - count: %u, nulls: %u, sum: %lf, min: %lf, max: %lf\n", agg.count, agg.null_count,
+        agg.to_double(agg.sum), agg.to_double(agg.min_val), agg.to_double(agg.max_val));
+      t = print_time_taken(t, "Time taken for aggregate: ");
+    } else
+      printf("Aggregate not supported for this column\n");
+
+    if (argc > 4) {
+      // bounds in stored form, decimals scaled by 10^n
+      int64_t lo = atoll(argv[3]);
+      int64_t hi = atoll(argv[4]);
+      int64_t match_sum = 0;
+      uint32_t match_count = dict_reader.scan_where(column_idx, lo, hi, [&match_sum](uint32_t, int64_t val) {
+        match_sum += val;
+        return true;
+      });
+      printf("Where %lld..%lld - count: %u, sum: %lf\n", (long long) lo, (long long) hi, match_count, agg.to_double(match_sum));
+      t = print_time_taken(t, "Time taken for scan_where: ");
+    }
+    return 1;
   }
   t = print_time_taken(t, "Time taken for sum: ");
 
@@ -19,6 +19,17 @@ const static size_t EMPTY_VALUE_LEN = 1;
 
 #define MDX_CACHE_SHIFT 5
 
+// Section locations in the header, in the order they are stored.
+// Version 1 has them as u32 at 8, 12, 20 and 64 onwards.
+// Version 2 adds all of them as u64 from MDX_HDR_V1_SIZE
+#define MDX_HDR_NAMES 0
+#define MDX_HDR_COL_VAL_TBL 1
+#define MDX_HDR_OPTS 2
+#define MDX_HDR_FWD_CACHE 3
+#define MDX_HDR_LOC_COUNT 21
+#define MDX_HDR_V1_SIZE 136
+#define MDX_HDR_V2_SIZE (MDX_HDR_V1_SIZE + MDX_HDR_LOC_COUNT * 8)
+
 // not used
 #define MDX_FWD_MRU_NID_CACHE 1
 #define MDX_REV_MRU_NID_CACHE 2
@@ -51,11 +62,36 @@ const static size_t EMPTY_VALUE_LEN = 1;
 
 #define bm_init_mask 0x0000000000000001ULL
 
+// MSE_DICT_DELTA columns store the running value at every 16 nodes of a bv block
+// so that random access sums at most 16 deltas
+#define MDX_DELTA_CKPT_NODES 16
+#define MDX_DELTA_CKPTS_PER_BLOCK (nodes_per_bv_block_n / MDX_DELTA_CKPT_NODES - 1)
+
+// Optional zone maps of numeric columns have an entry of
+// int64 min, int64 max, u32 null count and u32 padding per 512 rows
+#define MDX_ZONE_ROWS 512
+#define MDX_ZONE_ENTRY_SIZE 24
+
+// Word at offset MDX_COL_AUX_LOC of a column section locates its optional data
+// (0 if none), which starts with a header of u32 locations, 0 if absent, all
+// from the start of the section. For col tries it follows the reverse col trie.
+#define MDX_COL_AUX_LOC 28
+#define MDX_COL_AUX_CKPTS 0 // delta checkpoints
+#define MDX_COL_AUX_ZONES 4 // zone map
+#define MDX_COL_AUX_POSTINGS 8 // posting lists
+// offset 12 is reserved
+#define MDX_COL_AUX_HDR_SIZE 16
+
 #define BV_LT_TYPE_LEAF 1
 #define BV_LT_TYPE_TERM 2
 #define BV_LT_TYPE_CHILD 4
 #define BV_LT_TYPE_TAIL 8
 
+#define TF_PTR 0
+#define TF_TERM 1
+#define TF_CHILD 2
+#define TF_LEAF 3
+
 #define NFLAG_LEAF 1
 #define NFLAG_CHILD 2
 #define NFLAG_TAIL 4
@@ -163,14 +199,14 @@ struct PACKED_STRUCT bldr_options {
   uint8_t max_groups;
   uint8_t split_tails_method;
   uint8_t rpt_enable_perc;
-  uint8_t align8_padding2;
-  uint8_t align8_padding3;
-  uint8_t align8_padding4;
+  uint8_t hot_region_size; // in units of 4096 nodes, 0 = off
+  uint8_t inline_rank; // rank counters stored with trie_flags
+  uint8_t thread_count; // for build, 0 or 1 = single threaded
   uint16_t sfx_set_max_dflt;
 }; // 24 bytes
 
 const static bldr_options preset_opts[] = {
-  //  it,    fc,   rc,     lf,  dsct, sortn,   llt,    sc, scidx, mt, si, sr,  it, cm, cm, lc, mg, st, p, p, p, p, sfx
+  //  it,    fc,   rc,     lf,  dsct, sortn,   llt,    sc, scidx, mt, si, sr,  it, cm, cm, lc, mg, st, p, h, ir, th, sfx
   {false,  true,  true,  true, false, false, false,  true, false,  4,  3,  3,   0,  2,  2,  1, 16,  0, 0, 0, 0, 0, 64},
   { true,  true,  true, false, false, false, false,  true, false,  4,  3,  3,   0,  2,  2,  1, 16,  0, 0, 0, 0, 0, 64},
   { true,  true,  true,  true, false, false, false,  true, false,  4,  3,  3,   0,  2,  2,  1, 16,  0, 0, 0, 0, 0, 64}
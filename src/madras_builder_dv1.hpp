@@ -3,11 +3,14 @@
 
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/resource.h>
 #include <stdarg.h>
 #include <cstring>
 #include <algorithm>
 #include <map>
+#include <queue>
 #include <string>
+#include <thread>
 #include <vector>
 #include <iostream>
 #include <math.h>
@@ -62,12 +65,12 @@ struct trie_parts {
   uint32_t rev_cache_max_node_id;
   uint32_t sec_cache_count;
   uint32_t sec_cache_size;
-  uint32_t louds_rank_lt_loc;
-  uint32_t louds_sel1_lt_loc;
-  uint32_t trie_flags_loc;
+  uint64_t louds_rank_lt_loc;
+  uint64_t louds_sel1_lt_loc;
+  uint64_t trie_flags_loc;
   uint32_t louds_rank_lt_sz;
   uint32_t louds_sel1_lt_sz;
-  uint32_t tail_flags_loc;
+  uint64_t tail_flags_loc;
   uint32_t term_rank_lt_sz;
   uint32_t child_rank_lt_sz;
   uint32_t leaf_rank_lt_sz;
@@ -75,28 +78,36 @@ struct trie_parts {
   uint32_t term_select_lt_sz;
   uint32_t child_select_lt_sz;
   uint32_t leaf_select_lt_sz;
-  uint32_t opts_loc;
+  uint64_t opts_loc;
   uint32_t opts_size;
-  uint32_t fwd_cache_loc;
-  uint32_t rev_cache_loc;
-  uint32_t sec_cache_loc;
-  uint32_t term_select_lkup_loc;
-  uint32_t term_rank_lt_loc;
-  uint32_t child_rank_lt_loc;
-  uint32_t trie_tail_ptrs_data_loc;
+  uint64_t fwd_cache_loc;
+  uint64_t rev_cache_loc;
+  uint64_t sec_cache_loc;
+  uint64_t term_select_lkup_loc;
+  uint64_t term_rank_lt_loc;
+  uint64_t child_rank_lt_loc;
+  uint64_t trie_tail_ptrs_data_loc;
   uint32_t trie_tail_ptrs_data_sz;
-  uint32_t leaf_select_lkup_loc;
-  uint32_t leaf_rank_lt_loc;
-  uint32_t tail_rank_lt_loc;
-  uint32_t child_select_lkup_loc;
-  uint32_t names_loc;
+  uint64_t leaf_select_lkup_loc;
+  uint64_t leaf_rank_lt_loc;
+  uint64_t tail_rank_lt_loc;
+  uint64_t child_select_lkup_loc;
+  uint64_t names_loc;
   uint32_t names_sz;
-  uint32_t col_val_table_loc;
+  uint64_t col_val_table_loc;
   uint32_t col_val_table_sz;
-  uint32_t col_val_loc0;
-  uint32_t null_val_loc;
-  uint32_t empty_val_loc;
-  uint32_t total_idx_size;
+  uint64_t col_val_loc0;
+  uint64_t null_val_loc;
+  uint64_t empty_val_loc;
+  uint64_t hot_ns_loc;
+  uint32_t hot_ns_sz;
+  uint32_t hot_rank_lt_sz;
+  uint32_t hot_select_lt_sz;
+  uint32_t cold_select_lt_sz;
+  uint32_t trie_flags_pad;
+  uint32_t core_start_pad;
+  uint32_t core_end_pad;
+  uint64_t total_idx_size;
   bldr_min_pos_stats min_stats;
 };
 
@@ -114,7 +125,7 @@ void output_u32(uint32_t u32, FILE *fp, std::vector<uint8_t> *out_vec) {
     gen::write_uint32(u32, fp);
 }
 
-void output_u64(uint32_t u64, FILE *fp, std::vector<uint8_t> *out_vec) {
+void output_u64(uint64_t u64, FILE *fp, std::vector<uint8_t> *out_vec) {
   if (fp == NULL)
     gen::append_uint64(u64, *out_vec);
   else
@@ -210,8 +221,8 @@ class builder_fwd {
     virtual leopard::trie *get_memtrie() = 0;
     virtual builder_fwd *new_instance() = 0;
     virtual bool insert(const uint8_t *key, int key_len, uint32_t val_pos = UINT32_MAX) = 0;
-    virtual uint32_t build() = 0;
-    virtual uint32_t write_trie(const char *filename = NULL) = 0;
+    virtual uint64_t build() = 0;
+    virtual uint64_t write_trie(const char *filename = NULL) = 0;
 };
 
 class ptr_groups {
@@ -243,6 +254,8 @@ class ptr_groups {
     uint32_t idx2_ptr_count;
     uint64_t tot_ptr_bit_count;
     uint32_t max_len;
+    uint32_t col_aux_loc;
+    byte_vec col_aux;
   public:
     std::vector<builder_fwd *> inner_tries;
     size_t inner_trie_start_grp;
@@ -268,6 +281,8 @@ class ptr_groups {
       inner_tries.resize(0);
       ptrs.resize(0);
       idx2_ptrs_map.resize(0);
+      col_aux.resize(0);
+      col_aux_loc = 0;
       next_idx = 0;
       idx_limit = 0;
       inner_trie_start_grp = 0;
@@ -458,11 +473,35 @@ class ptr_groups {
     uint32_t get_total_size() {
       if (enc_type == MSE_TRIE || enc_type == MSE_TRIE_2WAY) {
         return gen::size_align8(grp_data_size) + get_ptrs_size() +
-                  gen::size_align8(ptr_lookup_tbl_sz) + 7 * 4 + 4;
+                  gen::size_align8(ptr_lookup_tbl_sz) + 7 * 4 + 4 + col_aux.size();
       }
       return gen::size_align8(grp_data_size) + get_ptrs_size() +
         gen::size_align8(idx2_ptrs_map.size()) +
-        gen::size_align8(ptr_lookup_tbl_sz) + 7 * 4 + 4;
+        gen::size_align8(ptr_lookup_tbl_sz) + 7 * 4 + 4 + col_aux.size();
+    }
+    // Appends delta checkpoints, zone map and postings after the column data, call after build().
+    // For col tries the aux data follows the reverse col trie, rev_trie_size bytes long.
+    // See MDX_COL_AUX_LOC for the layout.
+    void set_col_aux(std::vector<int64_t>& delta_ckpts, byte_vec& zone_map, byte_vec& postings, uint32_t rev_trie_size = 0) {
+      col_aux.resize(0);
+      col_aux_loc = 0;
+      if (delta_ckpts.size() == 0 && zone_map.size() == 0 && postings.size() == 0)
+        return;
+      col_aux_loc = get_total_size() + gen::size_align8(rev_trie_size);
+      uint32_t ckpts_loc = col_aux_loc + MDX_COL_AUX_HDR_SIZE;
+      uint32_t zone_map_loc = ckpts_loc + delta_ckpts.size() * sizeof(int64_t);
+      uint32_t postings_loc = zone_map_loc + zone_map.size();
+      gen::append_uint32(delta_ckpts.size() == 0 ? 0 : ckpts_loc, col_aux); // MDX_COL_AUX_CKPTS
+      gen::append_uint32(zone_map.size() == 0 ? 0 : zone_map_loc, col_aux); // MDX_COL_AUX_ZONES
+      gen::append_uint32(postings.size() == 0 ? 0 : postings_loc, col_aux); // MDX_COL_AUX_POSTINGS
+      gen::append_uint32(0, col_aux);
+      for (size_t i = 0; i < delta_ckpts.size(); i++)
+        gen::append_uint64((uint64_t) delta_ckpts[i], col_aux);
+      col_aux.insert(col_aux.end(), zone_map.begin(), zone_map.end());
+      col_aux.insert(col_aux.end(), postings.begin(), postings.end());
+    }
+    void write_col_aux(FILE *fp, byte_vec *out_vec) {
+      output_bytes(col_aux.data(), col_aux.size(), fp, out_vec);
     }
     void set_ptr_lkup_tbl_ptr_width(uint8_t width) {
       ptr_lkup_tbl_ptr_width = width;
@@ -672,7 +711,7 @@ class ptr_groups {
       output_u32(idx2_ptr_count, fp, out_vec);
       output_u32(idx2_ptrs_map_loc, fp, out_vec);
       output_u32(grp_ptrs_loc, fp, out_vec);
-      output_u32(0, fp, out_vec); // padding
+      output_u32(col_aux_loc, fp, out_vec);
 
       if (enc_type == MSE_TRIE || enc_type == MSE_TRIE_2WAY) {
         write_ptrs(fp, out_vec);
@@ -685,6 +724,7 @@ class ptr_groups {
         output_align8(idx2_ptrs_map->size(), fp, out_vec);
         write_grp_data(grp_data_loc + 520, is_tail, fp, out_vec); // group count, 512 lookup tbl, tail locs, tails
         output_align8(grp_data_size, fp, out_vec);
+        write_col_aux(fp, out_vec);
       }
       gen::gen_printf("Data size: %u, Ptrs size: %u, LkupTbl size: %u\nIdxMap size: %u, Total size: %u\n",
         get_data_size(), get_ptrs_size(), ptr_lookup_tbl_sz, get_idx2_ptrs_map()->size(), get_total_size());//, ftell(fp)-ftell_start);
@@ -1359,8 +1399,40 @@ class tail_val_maps {
 
 typedef std::vector<uniq_info *> uniq_info_vec;
 
+// Sorts chunks in parallel and merges them. Only the order of equal
+// elements may differ from std::sort, which make_uniq does not depend on.
+template <class iter_t, class cmp_t>
+void par_sort(iter_t begin, iter_t end, cmp_t cmp, int thread_count) {
+  size_t count = end - begin;
+  if (thread_count < 2 || count < 65536) {
+    std::sort(begin, end, cmp);
+    return;
+  }
+  std::vector<iter_t> bounds;
+  for (int i = 0; i < thread_count; i++)
+    bounds.push_back(begin + count * i / thread_count);
+  bounds.push_back(end);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < thread_count; i++)
+    threads.push_back(std::thread([&bounds, cmp, i]() { std::sort(bounds[i], bounds[i + 1], cmp); }));
+  for (size_t i = 0; i < threads.size(); i++)
+    threads[i].join();
+  for (size_t step = 1; step < (size_t) thread_count; step *= 2) {
+    threads.clear();
+    for (size_t i = 0; i + step < (size_t) thread_count; i += step * 2) {
+      iter_t merge_end = bounds[i + step * 2 > (size_t) thread_count ? thread_count : i + step * 2];
+      threads.push_back(std::thread([&bounds, cmp, i, step, merge_end]() {
+        std::inplace_merge(bounds[i], bounds[i + step], merge_end, cmp);
+      }));
+    }
+    for (size_t i = 0; i < threads.size(); i++)
+      threads[i].join();
+  }
+}
+
 class sort_callbacks {
   public:
+    int thread_count = 1;
     virtual uint8_t *get_data_and_len(leopard::node& n, uint32_t& len, char type = '*') = 0;
     virtual void set_uniq_pos(uint32_t ns_id, uint8_t node_idx, size_t pos) = 0;
     virtual int compare(const uint8_t *v1, int len1, const uint8_t *v2, int len2, int trie_level) = 0;
@@ -1403,13 +1475,13 @@ class tail_sort_callbacks : public sort_callbacks {
     void sort_data(node_data_vec& nodes_for_sort, int trie_level) {
       clock_t t = clock();
       if (trie_level == 0) {
-        std::sort(nodes_for_sort.begin(), nodes_for_sort.end(), [](const struct node_data& lhs, const struct node_data& rhs) -> bool {
+        par_sort(nodes_for_sort.begin(), nodes_for_sort.end(), [](const struct node_data& lhs, const struct node_data& rhs) -> bool {
           return gen::compare_rev(lhs.data, lhs.len, rhs.data, rhs.len) < 0;
-        });
+        }, thread_count);
       } else {
-        std::sort(nodes_for_sort.begin(), nodes_for_sort.end(), [](const struct node_data& lhs, const struct node_data& rhs) -> bool {
+        par_sort(nodes_for_sort.begin(), nodes_for_sort.end(), [](const struct node_data& lhs, const struct node_data& rhs) -> bool {
           return gen::compare(lhs.data, lhs.len, rhs.data, rhs.len) < 0;
-        });
+        }, thread_count);
       }
       t = gen::print_time_taken(t, "Time taken for sort tails: ");
     }
@@ -1474,13 +1546,13 @@ class val_sort_callbacks : public sort_callbacks {
     }
     void sort_data(node_data_vec& nodes_for_sort, int trie_level) {
       clock_t t = clock();
-      std::sort(nodes_for_sort.begin(), nodes_for_sort.end(), [](const struct node_data& lhs, const struct node_data& rhs) -> bool {
+      par_sort(nodes_for_sort.begin(), nodes_for_sort.end(), [](const struct node_data& lhs, const struct node_data& rhs) -> bool {
         if (rhs.data == NULL)
           return false;
         if (lhs.data == NULL)
           return true;
         return gen::compare(lhs.data, lhs.len, rhs.data, rhs.len) < 0;
-      });
+      }, thread_count);
       t = gen::print_time_taken(t, "Time taken for sort vals: ");
     }
 };
@@ -1590,6 +1662,299 @@ class uniq_maker {
     }
 };
 
+// Creates the node sets of a memtrie directly from keys given in ascending order.
+// Consecutive keys are compared to find their common prefix and a node set is
+// created once, with its final node count, as soon as the prefix above it closes.
+// Only the nodes along the path of the last key are held in between.
+class sorted_trie_maker {
+  private:
+    struct node_rec {
+      uint8_t flags;
+      uint8_t node_byte;
+      uint32_t tail_pos;
+      uint32_t child_ns_id;
+      uint32_t col_val;
+    };
+    struct open_node {
+      uint32_t start; // label is last_key[start..end)
+      uint32_t end;
+      bool is_leaf;
+      uint32_t col_val;
+      std::vector<node_rec> children;
+    };
+    leopard::trie& memtrie;
+    std::vector<open_node> path;
+    std::vector<uint8_t> last_key;
+    sorted_trie_maker(sorted_trie_maker const&);
+    sorted_trie_maker& operator=(sorted_trie_maker const&);
+
+    uint32_t make_node_set(std::vector<node_rec>& recs) {
+      uint32_t ns_id = leopard::node_set_handler::create_node_set(memtrie.all_node_sets, recs.size());
+      leopard::node_set_handler nsh(memtrie.all_node_sets, ns_id);
+      leopard::node n = nsh.first_node();
+      for (size_t i = 0; i < recs.size(); i++) {
+        node_rec *nr = &recs[i];
+        n.set_flags(nr->flags | (i == recs.size() - 1 ? NFLAG_TERM : 0));
+        n.set_byte(nr->node_byte);
+        if (nr->flags & NFLAG_TAIL)
+          n.set_tail(nr->tail_pos);
+        if (nr->flags & NFLAG_CHILD)
+          n.set_child(nr->child_ns_id);
+        if (nr->flags & NFLAG_LEAF)
+          n.set_col_val(nr->col_val);
+        n.next();
+      }
+      memtrie.node_set_count++;
+      memtrie.node_count += recs.size();
+      return ns_id;
+    }
+
+    node_rec close_node(open_node& on) {
+      node_rec nr = {};
+      uint32_t label_len = on.end - on.start;
+      nr.node_byte = last_key[on.start];
+      if (label_len > 1) {
+        nr.flags |= NFLAG_TAIL;
+        nr.tail_pos = memtrie.all_tails->push_back_with_vlen(last_key.data() + on.start, label_len);
+        if (memtrie.max_tail_len < label_len)
+          memtrie.max_tail_len = label_len;
+      }
+      if (on.is_leaf) {
+        nr.flags |= NFLAG_LEAF;
+        nr.col_val = on.col_val;
+      }
+      if (on.children.size() > 0) {
+        nr.flags |= NFLAG_CHILD;
+        nr.child_ns_id = make_node_set(on.children);
+      }
+      return nr;
+    }
+
+    void close_last() {
+      node_rec nr = close_node(path.back());
+      path.pop_back();
+      path.back().children.push_back(nr);
+    }
+
+  public:
+    sorted_trie_maker(leopard::trie& _memtrie) : memtrie (_memtrie) {
+      // set 0 holds the dummy node pointing to the root, which has to be set 1.
+      // The root is created last by finish(), so set 1 is only reserved here.
+      if (memtrie.all_node_sets.size() == 0) {
+        leopard::node_set_handler::create_node_set(memtrie.all_node_sets, 1);
+        memtrie.node_set_count++;
+        memtrie.node_count++;
+      }
+      if (memtrie.all_node_sets.size() == 1)
+        memtrie.all_node_sets.push_back(NULL);
+      path.push_back((open_node) {0, 0, false, 0, std::vector<node_rec>()});
+    }
+
+    // Returns false if key is empty or not greater than the previous key
+    bool add(const uint8_t *key, int key_len, uint32_t val_pos) {
+      if (key_len <= 0)
+        return false;
+      uint32_t lcp = 0;
+      uint32_t last_len = last_key.size();
+      while (lcp < last_len && lcp < (uint32_t) key_len && last_key[lcp] == key[lcp])
+        lcp++;
+      if (lcp == (uint32_t) key_len)
+        return false;
+      if (lcp < last_len && key[lcp] < last_key[lcp])
+        return false;
+      while (path.size() > 1 && path.back().start >= lcp)
+        close_last();
+      open_node& top = path.back();
+      if (path.size() > 1 && lcp < top.end) {
+        // key branches off in the middle of the label
+        open_node rest = {lcp, top.end, top.is_leaf, top.col_val, std::vector<node_rec>()};
+        rest.children.swap(top.children);
+        node_rec nr = close_node(rest);
+        top.children.push_back(nr);
+        top.end = lcp;
+        top.is_leaf = false;
+      }
+      path.push_back((open_node) {lcp, (uint32_t) key_len, true, val_pos, std::vector<node_rec>()});
+      last_key.assign(key, key + key_len);
+      memtrie.key_count++;
+      if (memtrie.max_key_len < (uint32_t) key_len)
+        memtrie.max_key_len = key_len;
+      return true;
+    }
+
+    void finish() {
+      if (last_key.size() == 0) {
+        // no keys, set 1 becomes an empty root
+        uint32_t ns_id = leopard::node_set_handler::create_node_set(memtrie.all_node_sets, 1);
+        memtrie.node_set_count++;
+        memtrie.node_count++;
+        memtrie.all_node_sets[1] = memtrie.all_node_sets[ns_id];
+        memtrie.all_node_sets.pop_back();
+        return;
+      }
+      while (path.size() > 1)
+        close_last();
+      uint32_t root_ns_id = make_node_set(path.back().children);
+      path.clear();
+      // root was created last, move it to set 1 reserved by the constructor
+      memtrie.all_node_sets[1] = memtrie.all_node_sets[root_ns_id];
+      memtrie.all_node_sets.pop_back();
+      leopard::node_set_handler nsh(memtrie.all_node_sets, 0);
+      leopard::node n = nsh.first_node();
+      n.set_flags(NFLAG_CHILD | NFLAG_TERM);
+      n.set_child(1);
+    }
+};
+
+// Buffers (key, record) pairs and, once the buffer crosses the memory budget,
+// writes them out sorted on key as a run to a temp file.
+// merge() returns all pairs in key order. Records of a key are resolved in insertion
+// order as builder::insert() does: a record replaces the kept one unless it is longer.
+class ext_sorter {
+  private:
+    struct run_reader {
+      FILE *fp;
+      size_t run_idx;
+      byte_vec key;
+      byte_vec rec;
+      bool next() {
+        uint32_t lens[2];
+        if (fread(lens, sizeof(uint32_t), 2, fp) != 2)
+          return false;
+        key.resize(lens[0]);
+        rec.resize(lens[1]);
+        if (fread(key.data(), 1, lens[0], fp) != lens[0] || fread(rec.data(), 1, lens[1], fp) != lens[1])
+          return false;
+        return true;
+      }
+    };
+    // Smallest key first and, for equal keys, the earlier run, so that records
+    // of a key come out in insertion order (runs are stable sorted)
+    struct run_cmp {
+      bool operator()(const run_reader *lhs, const run_reader *rhs) const {
+        int cmp = gen::compare(lhs->key.data(), lhs->key.size(), rhs->key.data(), rhs->key.size());
+        if (cmp == 0)
+          return lhs->run_idx > rhs->run_idx;
+        return cmp > 0;
+      }
+    };
+    size_t mem_budget;
+    std::string tmp_dir;
+    byte_vec buf;
+    std::vector<size_t> entries;
+    std::vector<FILE *> runs;
+    size_t spilled_size;
+    ext_sorter(ext_sorter const&);
+    ext_sorter& operator=(ext_sorter const&);
+
+    const uint8_t *entry_key(size_t pos, uint32_t& len) {
+      memcpy(&len, buf.data() + pos, sizeof(uint32_t));
+      return buf.data() + pos + sizeof(uint32_t) * 2;
+    }
+
+    void spill() {
+      if (entries.size() == 0)
+        return;
+      std::stable_sort(entries.begin(), entries.end(), [this](size_t lhs, size_t rhs) -> bool {
+        uint32_t lhs_len, rhs_len;
+        const uint8_t *lhs_key = entry_key(lhs, lhs_len);
+        const uint8_t *rhs_key = entry_key(rhs, rhs_len);
+        return gen::compare(lhs_key, lhs_len, rhs_key, rhs_len) < 0;
+      });
+      FILE *fp = create_tmp_file();
+      for (size_t i = 0; i < entries.size(); i++) {
+        uint32_t lens[2];
+        memcpy(lens, buf.data() + entries[i], sizeof(lens));
+        size_t entry_len = sizeof(lens) + lens[0] + lens[1];
+        if (fwrite(buf.data() + entries[i], 1, entry_len, fp) != entry_len) {
+          printf("Error writing run: %d\n", errno);
+          throw errno;
+        }
+      }
+      spilled_size += buf.size();
+      runs.push_back(fp);
+      gen::gen_printf("Spilled run %lu: %lu entries\n", runs.size(), entries.size());
+      buf.clear();
+      entries.clear();
+    }
+
+  public:
+    // Creates an unnamed file in tmp_dir, removed when closed
+    FILE *create_tmp_file() {
+      std::string tmp_file = tmp_dir + "/mdx_runXXXXXX";
+      int fd = mkstemp(&tmp_file[0]);
+      FILE *fp = (fd == -1 ? NULL : fdopen(fd, "w+b"));
+      if (fp == NULL) {
+        printf("Error creating run in %s: %d\n", tmp_dir.c_str(), errno);
+        throw errno;
+      }
+      unlink(tmp_file.c_str());
+      return fp;
+    }
+
+    ext_sorter(size_t _mem_budget, const char *_tmp_dir)
+        : mem_budget (_mem_budget), tmp_dir (_tmp_dir), spilled_size (0) {
+    }
+
+    ~ext_sorter() {
+      for (size_t i = 0; i < runs.size(); i++)
+        fclose(runs[i]);
+    }
+
+    void add(const uint8_t *key, uint32_t key_len, const uint8_t *rec, uint32_t rec_len) {
+      entries.push_back(buf.size());
+      uint32_t lens[2] = {key_len, rec_len};
+      const uint8_t *lens_bytes = (const uint8_t *) lens;
+      buf.insert(buf.end(), lens_bytes, lens_bytes + sizeof(lens));
+      buf.insert(buf.end(), key, key + key_len);
+      buf.insert(buf.end(), rec, rec + rec_len);
+      if (buf.size() + entries.size() * sizeof(size_t) > mem_budget)
+        spill();
+    }
+
+    size_t get_run_count() {
+      return runs.size();
+    }
+
+    size_t get_spilled_size() {
+      return spilled_size;
+    }
+
+    void merge(std::function<void(const uint8_t *, uint32_t, const uint8_t *, uint32_t)> emit) {
+      spill();
+      std::vector<run_reader> readers(runs.size());
+      std::priority_queue<run_reader *, std::vector<run_reader *>, run_cmp> pq;
+      for (size_t i = 0; i < runs.size(); i++) {
+        rewind(runs[i]);
+        setvbuf(runs[i], NULL, _IOFBF, 1 << 20);
+        readers[i].fp = runs[i];
+        readers[i].run_idx = i;
+        if (readers[i].next())
+          pq.push(&readers[i]);
+      }
+      byte_vec key;
+      byte_vec rec;
+      while (!pq.empty()) {
+        run_reader *rr = pq.top();
+        pq.pop();
+        key.swap(rr->key);
+        rec.swap(rr->rec);
+        if (rr->next())
+          pq.push(rr);
+        // as with insert(), a later record replaces the kept one if it is not longer
+        while (!pq.empty() && gen::compare(pq.top()->key.data(), pq.top()->key.size(), key.data(), key.size()) == 0) {
+          rr = pq.top();
+          pq.pop();
+          if (rr->rec.size() <= rec.size())
+            rec.swap(rr->rec);
+          if (rr->next())
+            pq.push(rr);
+        }
+        emit(key.data(), key.size(), rec.data(), rec.size());
+      }
+    }
+};
+
 class builder : public builder_fwd {
 
   private:
@@ -1604,6 +1969,20 @@ class builder : public builder_fwd {
     //builder(builder const&);
     //builder& operator=(builder const&);
 
+    // With opts.inline_rank, each 64 node block of trie_flags is padded to 64 bytes
+    // with the ranks of ptr, term, child and leaf before the block, so that
+    // rank1() finds both the counter and the bitmap in the same cache line
+    void append_inline_ranks(byte_vec& byv, uint32_t *ranks, uint64_t bm_ptr, uint64_t bm_term, uint64_t bm_child, uint64_t bm_leaf) {
+      for (int i = TF_PTR; i <= TF_LEAF; i++)
+        gen::append_uint32(ranks[i], byv);
+      append64_t(byv, 0);
+      append64_t(byv, 0);
+      ranks[TF_PTR] += __builtin_popcountll(bm_ptr);
+      ranks[TF_TERM] += __builtin_popcountll(bm_term);
+      ranks[TF_CHILD] += __builtin_popcountll(bm_child);
+      ranks[TF_LEAF] += __builtin_popcountll(bm_leaf);
+    }
+
     void append64_t(byte_vec& byv, uint64_t b64) {
       // byv.push_back(b64 >> 56);
       // byv.push_back((b64 >> 48) & 0xFF);
@@ -1639,6 +2018,13 @@ class builder : public builder_fwd {
     char *out_filename;
     byte_vec trie;
     gen::bit_vector<uint64_t> louds;
+    std::vector<uint64_t> hot_child_bm;
+    std::vector<uint64_t> cold_child_bm;
+    uint32_t hot_ns_count;
+    uint32_t hot_node_count;
+    uint32_t hot_child_count;
+    uint32_t cold_child_count;
+    bool has_ns_profile;
     byte_vec trie_flags;
     byte_vec trie_flags_tail;
     byte_vec trie_flags_leaf;
@@ -1663,8 +2049,15 @@ class builder : public builder_fwd {
     uint16_t *names_positions;
     uint16_t names_len;
     uint32_t prev_val_size;
-    uint32_t *val_table;
+    uint64_t *val_table;
+    uint8_t hdr_version;
+    uint32_t section_align;
+    bool zone_maps_enabled;
     leopard::trie *col_trie;
+    sorted_trie_maker *sorted_maker;
+    ext_sorter *ext_sort;
+    FILE *ext_recs; // merged records, loaded one column at a time
+    std::vector<uint32_t> ext_col_pos;
     builder *col_trie_builder;
     builder *tail_trie_builder;
     char *sk_col_positions;
@@ -1689,12 +2082,18 @@ class builder : public builder_fwd {
       memcpy(empty_value, _empty_value, _empty_value_len);
       empty_value_len = _empty_value_len;
       trie_level = _trie_level;
+      hdr_version = 1;
+      section_align = 0;
+      zone_maps_enabled = false;
       tp = {};
       col_trie = NULL;
       col_trie_builder = NULL;
+      sorted_maker = NULL;
+      ext_sort = NULL;
+      ext_recs = NULL;
       tail_trie_builder = NULL;
       column_count = _column_count;
-      val_table = new uint32_t[_column_count];
+      val_table = new uint64_t[_column_count];
       column_encodings = new char[_column_count];
       memset(column_encodings, 'u', _column_count);
       *column_encodings = MSE_TRIE; // first letter is for key
@@ -1721,6 +2120,9 @@ class builder : public builder_fwd {
       all_vals->push_back("\0", 2);
       cur_seq_idx = 0;
       is_ns_sorted = false;
+      hot_ns_count = hot_node_count = 0;
+      hot_child_count = cold_child_count = 0;
+      has_ns_profile = false;
     }
 
     virtual ~builder() {
@@ -1736,6 +2138,12 @@ class builder : public builder_fwd {
         delete col_trie_builder;
       if (tail_trie_builder != NULL)
         delete tail_trie_builder;
+      if (sorted_maker != NULL)
+        delete sorted_maker;
+      if (ext_sort != NULL)
+        delete ext_sort;
+      if (ext_recs != NULL)
+        fclose(ext_recs);
       if (f_cache != nullptr)
         delete [] f_cache;
       if (r_cache != nullptr)
@@ -1823,6 +2231,70 @@ class builder : public builder_fwd {
       return freq_count;
     }
 
+    // Looks up key in memtrie, calling on_match for each node matched on the way
+    bool walk_key(const uint8_t *key, int key_len, std::function<void(leopard::node_set_handler&, leopard::node&, size_t, bool)> on_match) {
+      int key_pos = 0;
+      uint32_t ns_id = 1;
+      leopard::node_set_handler nsh(memtrie.all_node_sets, ns_id);
+      while (ns_id > 0 && key_pos < key_len) {
+        nsh.set_pos(ns_id);
+        leopard::node n = nsh.first_node();
+        size_t i = 0;
+        for (; i <= nsh.last_node_idx(); i++) {
+          if (n.get_byte() == key[key_pos])
+            break;
+          n.next();
+        }
+        if (i > nsh.last_node_idx())
+          return false;
+        if (n.get_flags() & NFLAG_TAIL) {
+          uint8_t *tail = (*memtrie.all_tails)[n.get_tail()];
+          size_t vlen;
+          uint32_t tail_len = gen::read_vint32(tail, &vlen);
+          if (key_pos + tail_len > key_len || memcmp(tail + vlen, key + key_pos, tail_len) != 0)
+            return false;
+          key_pos += tail_len;
+        } else
+          key_pos++;
+        on_match(nsh, n, i, key_pos == key_len);
+        if (key_pos == key_len)
+          return (n.get_flags() & NFLAG_LEAF) != 0;
+        ns_id = (n.get_flags() & NFLAG_CHILD) ? n.get_child() : 0;
+      }
+      return false;
+    }
+
+    // Adds freq to each node set visited when looking up key in memtrie.
+    // Used in place of set_ns_freq() for sort_nodes_on_freq and hot_region_size
+    // and in place of subtree counts for filling the fwd and rev caches
+    bool add_ns_profile(const uint8_t *key, int key_len, uint32_t freq = 1) {
+      if (is_ns_sorted)
+        return false;
+      has_ns_profile = true;
+      return walk_key(key, key_len, [freq](leopard::node_set_handler& nsh, leopard::node&, size_t, bool) -> void {
+        nsh.hdr()->freq += freq;
+      });
+    }
+
+    // Replays key against the fwd cache made by build_cache(), counting the
+    // transitions to child node sets and how many of them are found in the cache
+    void replay_fwd_cache(const uint8_t *key, int key_len, uint64_t& hit_count, uint64_t& step_count) {
+      if (f_cache == nullptr)
+        return;
+      uint32_t cache_mask = tp.fwd_cache_count - 1;
+      walk_key(key, key_len, [this, cache_mask, &hit_count, &step_count](leopard::node_set_handler& nsh,
+                  leopard::node& n, size_t, bool is_last) -> void {
+        if (is_last || n.get_child() == 0 || (n.get_flags() & NFLAG_TAIL))
+          return;
+        uint32_t ns_node_id = nsh.hdr()->node_id;
+        uint8_t node_byte = n.get_byte();
+        fwd_cache *fc = f_cache + ((ns_node_id ^ (ns_node_id << MDX_CACHE_SHIFT) ^ node_byte) & cache_mask);
+        step_count++;
+        if (gen::read_uint24(&fc->parent_node_id1) == ns_node_id && fc->node_byte == node_byte)
+          hit_count++;
+      });
+    }
+
     void split_tails() {
       clock_t t = clock();
       typedef struct {
@@ -2023,9 +2495,10 @@ class builder : public builder_fwd {
       uint32_t nxt_node = 0;
       uint32_t node_set_id = 1;
       leopard::node_set_handler nsh(memtrie.all_node_sets, 0);
+      if (!has_ns_profile && (opts.sort_nodes_on_freq || (opts.hot_region_size > 0 && trie_level == 0)))
+        set_ns_freq(1, 0);
       if (opts.sort_nodes_on_freq) {
         // avg_freq_all_ns = 0;
-        set_ns_freq(1, 0);
         // printf("Avg freq: %llu\n", avg_freq_all_ns);
         // avg_freq_all_ns /= node_set_count;
         // printf("Avg freq: %llu\n", avg_freq_all_ns);
@@ -2057,9 +2530,105 @@ class builder : public builder_fwd {
         n.next();
       }
       is_ns_sorted = true;
+      if (opts.hot_region_size > 0 && trie_level == 0)
+        make_hot_region();
       gen::print_time_taken(t, "Time taken for sort_nodes(): ");
     }
 
+    // Moves the most frequent node sets (by hdr()->freq) to the front so that
+    // they occupy a contiguous hot region of at most hot_region_size * 4096 nodes.
+    // Hot sets are chosen from the root down so that the region is closed upwards.
+    // Hot sets are then numbered in the order of their parent nodes, followed
+    // by the cold sets, also in the order of their parent nodes.
+    void make_hot_region() {
+      uint32_t ns_count = memtrie.all_node_sets.size();
+      uint32_t node_budget = (uint32_t) opts.hot_region_size * 4096;
+      std::vector<bool> is_hot(ns_count, false);
+      typedef std::pair<uint32_t, uint32_t> freq_ns;
+      auto cmp_freq = [](const freq_ns& lhs, const freq_ns& rhs) -> bool {
+        if (lhs.first == rhs.first)
+          return lhs.second > rhs.second;
+        return lhs.first < rhs.first;
+      };
+      std::priority_queue<freq_ns, std::vector<freq_ns>, decltype(cmp_freq)> to_visit(cmp_freq);
+      leopard::node_set_handler nsh(memtrie.all_node_sets, 1);
+      to_visit.push(freq_ns(nsh.hdr()->freq, 1));
+      uint32_t hot_nodes = 1;
+      hot_ns_count = 0;
+      while (!to_visit.empty()) {
+        uint32_t ns_id = to_visit.top().second;
+        to_visit.pop();
+        nsh.set_pos(ns_id);
+        uint32_t ns_node_count = nsh.last_node_idx() + 2; // + 1 for leap
+        if (hot_nodes + ns_node_count > node_budget)
+          break;
+        hot_nodes += ns_node_count;
+        is_hot[ns_id] = true;
+        hot_ns_count++;
+        leopard::node n = nsh.first_node();
+        for (size_t i = 0; i <= nsh.last_node_idx(); i++) {
+          if (n.get_child() > 0) {
+            leopard::node_set_handler nsh_child(memtrie.all_node_sets, n.get_child());
+            to_visit.push(freq_ns(nsh_child.hdr()->freq, n.get_child()));
+          }
+          n.next();
+        }
+      }
+      if (hot_ns_count == 0 || hot_ns_count + 1 == ns_count)
+        return;
+      std::vector<uint32_t> new_order(ns_count, 0);
+      uint32_t hot_pos = 1;
+      uint32_t cold_pos = hot_ns_count + 1;
+      for (uint32_t pos = 0; pos < ns_count; pos++) {
+        nsh.set_pos(new_order[pos]);
+        leopard::node n = nsh.first_node();
+        for (size_t i = 0; i <= nsh.last_node_idx(); i++) {
+          uint32_t child_ns_id = n.get_child();
+          if (child_ns_id > 0) {
+            uint32_t child_pos = is_hot[child_ns_id] ? hot_pos++ : cold_pos++;
+            new_order[child_pos] = child_ns_id;
+            n.set_child(child_pos);
+          }
+          n.next();
+        }
+      }
+      byte_ptr_vec prev_order(memtrie.all_node_sets);
+      for (uint32_t pos = 0; pos < ns_count; pos++)
+        memtrie.all_node_sets[pos] = prev_order[new_order[pos]];
+      gen::gen_printf("Hot node sets: %u, nodes: %u\n", hot_ns_count, hot_nodes);
+    }
+
+    // Splits the child flags of the hot region nodes into those
+    // pointing to hot node sets and those pointing to cold node sets
+    void build_hot_child_bm() {
+      hot_node_count = memtrie.node_count;
+      if (hot_ns_count + 1 < memtrie.all_node_sets.size()) {
+        leopard::node_set_handler nsh(memtrie.all_node_sets, hot_ns_count + 1);
+        hot_node_count = nsh.hdr()->node_id;
+      }
+      size_t word_count = (hot_node_count + nodes_per_bv_block_n - 1) / nodes_per_bv_block_n;
+      hot_child_bm.assign(word_count, 0);
+      cold_child_bm.assign(word_count, 0);
+      hot_child_count = cold_child_count = 0;
+      uint32_t node_id = 0;
+      leopard::node_iterator ni(memtrie.all_node_sets, 0);
+      leopard::node cur_node = ni.next();
+      while (cur_node != nullptr && node_id < hot_node_count) {
+        if ((cur_node.get_flags() & NODE_SET_LEAP) == 0 && (cur_node.get_flags() & NFLAG_CHILD)) {
+          uint64_t bm_mask = bm_init_mask << (node_id % nodes_per_bv_block_n);
+          if (cur_node.get_child() <= hot_ns_count) {
+            hot_child_bm[node_id / nodes_per_bv_block_n] |= bm_mask;
+            hot_child_count++;
+          } else {
+            cold_child_bm[node_id / nodes_per_bv_block_n] |= bm_mask;
+            cold_child_count++;
+          }
+        }
+        node_id++;
+        cur_node = ni.next();
+      }
+    }
+
     uint8_t append_tail_ptr(leopard::node *cur_node) {
       if ((cur_node->get_flags() & NFLAG_TAIL) == 0)
         return cur_node->get_byte();
@@ -2345,11 +2914,82 @@ class builder : public builder_fwd {
       return u1len + u2len;
     }
 
-    uint32_t build_col_trie(gen::byte_blocks *val_blocks, builder *rev_col_trie_bldr) {
+    uint8_t ef_low_bits(uint64_t universe, uint32_t n) {
+      uint64_t q = universe / n;
+      uint8_t l = 0;
+      while ((q >> (l + 1)) > 0)
+        l++;
+      return l;
+    }
+    size_t ef_list_size(uint32_t n, uint8_t l, uint32_t last_row) {
+      size_t low_words = ((uint64_t) n * l + 63) / 64;
+      size_t high_words = ((uint64_t) n + (last_row >> l) + 1 + 63) / 64;
+      return 8 + (low_words + high_words) * 8;
+    }
+    // Elias-Fano list: u64 n | l << 32, n * l low bits, then a unary coded high part
+    // with bit (row >> l) + i set for the ith row
+    void append_ef_list(const uint32_t *rows, uint32_t n, uint8_t l, byte_vec& out) {
+      size_t low_words = ((uint64_t) n * l + 63) / 64;
+      size_t high_words = ((uint64_t) n + (rows[n - 1] >> l) + 1 + 63) / 64;
+      std::vector<uint64_t> words(low_words + high_words, 0);
+      uint64_t low_mask = (1ULL << l) - 1;
+      for (uint32_t i = 0; i < n; i++) {
+        if (l > 0) {
+          uint64_t bit_pos = (uint64_t) i * l;
+          uint64_t low = rows[i] & low_mask;
+          words[bit_pos / 64] |= (low << (bit_pos % 64));
+          if (bit_pos % 64 + l > 64)
+            words[bit_pos / 64 + 1] |= (low >> (64 - bit_pos % 64));
+        }
+        uint64_t high_pos = (rows[i] >> l) + i;
+        words[low_words + high_pos / 64] |= (1ULL << (high_pos % 64));
+      }
+      gen::append_uint64(n | ((uint64_t) l << 32), out);
+      for (size_t i = 0; i < words.size(); i++)
+        gen::append_uint64(words[i], out);
+    }
+    // Row ids of each col trie value: u32 list count, u32 pad, u32 offsets[list count + 1]
+    // aligned to 8 and the Elias-Fano lists. Values without rows have empty lists.
+    void build_postings(std::vector<uint32_t>& row_vals, std::vector<uint32_t>& row_ids, uint32_t max_node_id, byte_vec& postings) {
+      uint32_t list_count = max_node_id + 1;
+      std::vector<uint32_t> list_start(list_count + 1, 0);
+      for (size_t i = 0; i < row_vals.size(); i++)
+        list_start[row_vals[i] + 1]++;
+      for (uint32_t i = 0; i < list_count; i++)
+        list_start[i + 1] += list_start[i];
+      // rows arrive in order, so each list stays sorted
+      std::vector<uint32_t> sorted_rows(row_ids.size());
+      std::vector<uint32_t> fill_pos(list_start.begin(), list_start.end() - 1);
+      for (size_t i = 0; i < row_vals.size(); i++)
+        sorted_rows[fill_pos[row_vals[i]]++] = row_ids[i];
+      uint64_t universe = row_ids.size() == 0 ? 1 : (uint64_t) row_ids[row_ids.size() - 1] + 1;
+      gen::append_uint32(list_count, postings);
+      gen::append_uint32(0, postings);
+      uint32_t offset = 8 + gen::size_align8((list_count + 1) * 4);
+      for (uint32_t i = 0; i < list_count; i++) {
+        gen::append_uint32(offset, postings);
+        uint32_t n = list_start[i + 1] - list_start[i];
+        if (n > 0)
+          offset += ef_list_size(n, ef_low_bits(universe, n), sorted_rows[list_start[i + 1] - 1]);
+      }
+      gen::append_uint32(offset, postings);
+      while (postings.size() % 8)
+        postings.push_back(0);
+      for (uint32_t i = 0; i < list_count; i++) {
+        uint32_t n = list_start[i + 1] - list_start[i];
+        if (n > 0)
+          append_ef_list(sorted_rows.data() + list_start[i], n, ef_low_bits(universe, n), postings);
+      }
+      gen::gen_printf("Postings size: %lu, lists: %u\n", postings.size(), list_count);
+    }
+
+    uint32_t build_col_trie(gen::byte_blocks *val_blocks, builder *rev_col_trie_bldr, byte_vec *postings) {
       uint32_t col_trie_size = col_trie_builder->build();
       uint32_t max_node_id = 0;
       uint32_t node_id = 0;
-      uint32_t leaf_id = 1;
+      uint32_t leaf_id = 0;
+      std::vector<uint32_t> row_vals;
+      std::vector<uint32_t> row_ids;
       if (rev_col_trie_bldr != nullptr) {
         rev_col_trie_bldr->fp = fp;
         rev_col_trie_bldr->out_vec = out_vec;
@@ -2397,10 +3037,17 @@ class builder : public builder_fwd {
             size_t rev_key_len = make_rev_key(col_trie_node_id, node_id, rev_key);
             rev_col_trie_bldr->insert(rev_key, rev_key_len);
           }
+          if (postings != nullptr) {
+            row_vals.push_back(col_trie_node_id);
+            row_ids.push_back(pk_col_count > 0 ? leaf_id : node_id);
+          }
+          leaf_id++;
           node_id++;
           n.next();
         }
       }
+      if (postings != nullptr)
+        build_postings(row_vals, row_ids, max_node_id, *postings);
       byte_vec *ptr_grps = tail_vals.get_val_grp_ptrs()->get_ptrs();
       int bit_len = ceil(log2(max_node_id + 1));
       tail_vals.get_val_grp_ptrs()->set_ptr_lkup_tbl_ptr_width(bit_len);
@@ -2486,6 +3133,44 @@ class builder : public builder_fwd {
       return tot_rpt_count;
     }
 
+    // Replaces all_vals with the values of the current column read from ext_recs,
+    // in merged order, so that only one column of the records is in memory
+    void load_ext_col() {
+      all_vals->reset();
+      all_vals->push_back("\0", 2);
+      rewind(ext_recs);
+      byte_vec rec;
+      for (size_t i = 0; i < ext_col_pos.size(); i++) {
+        uint32_t rec_len;
+        if (fread(&rec_len, sizeof(uint32_t), 1, ext_recs) != 1) {
+          printf("Error reading merged records: %d\n", errno);
+          throw errno;
+        }
+        rec.resize(rec_len);
+        if (fread(rec.data(), 1, rec_len, ext_recs) != rec_len) {
+          printf("Error reading merged records: %d\n", errno);
+          throw errno;
+        }
+        uint8_t *data_pos = rec.data();
+        for (int col_idx = 0; col_idx < cur_col_idx; col_idx++)
+          data_pos += rec_value_len(column_types[col_idx], data_pos);
+        ext_col_pos[i] = all_vals->push_back_with_vlen(data_pos, rec_value_len(column_types[cur_col_idx], data_pos));
+      }
+    }
+
+    // Length of a value in a record, including its length prefix
+    size_t rec_value_len(char data_type, const uint8_t *data_pos) {
+      switch (data_type) {
+        case MST_TEXT:
+        case MST_BIN: {
+          size_t len_len = 0;
+          uint32_t data_len = gen::read_vint32(data_pos, &len_len);
+          return len_len + data_len;
+        }
+      }
+      return (*data_pos & 0x07) + 2;
+    }
+
     // FILE *col_trie_fp;
     uint32_t build_col_val() {
       clock_t t = clock();
@@ -2500,10 +3185,15 @@ class builder : public builder_fwd {
       gen::byte_blocks *delta_vals = nullptr;
       if (encoding_type == MSE_DICT_DELTA)
         delta_vals = new gen::byte_blocks();
+      std::vector<int64_t> delta_ckpts;
+      std::vector<col_zone> zones;
+      bool to_build_zones = zone_maps_enabled && data_type != MST_TEXT && data_type != MST_BIN && data_type != MST_DECV;
       bool is_rec_pos_src_leaf_id = false;
       if (pk_col_count == 0 || rec_pos_vec[0] == UINT32_MAX)
         is_rec_pos_src_leaf_id = true;
       rec_pos_vec[0] = UINT32_MAX;
+      if (ext_recs != NULL)
+        load_ext_col();
       // bool delta_next_block = true;
       node_data_vec nodes_for_sort;
       uint32_t pos = 2;
@@ -2528,9 +3218,12 @@ class builder : public builder_fwd {
           if (pk_col_count > 0 && !is_rec_pos_src_leaf_id)
             rec_pos_vec[leaf_id] = n.get_col_val();
           pos = rec_pos_vec[leaf_id];
+          if (ext_recs != NULL)
+            pos = ext_col_pos[pos];
           gen::read_vint32((*all_vals)[pos], &vlen);
           pos += vlen;
-          for (size_t col_idx = 0; col_idx < column_count; col_idx++) {
+          // loaded ext records hold only the current column
+          for (size_t col_idx = (ext_recs != NULL ? cur_col_idx : 0); col_idx < column_count; col_idx++) {
             uint8_t *data_pos = (*all_vals)[pos];
             size_t len_len = 0;
             uint32_t data_len = 0;
@@ -2552,6 +3245,8 @@ class builder : public builder_fwd {
               } break;
             }
             if (cur_col_idx == col_idx) {
+              if (to_build_zones)
+                add_to_zone(zones, (pk_col_count > 0 ? leaf_id : node_id) - 1, data_pos);
               if (encoding_type == MSE_DICT_DELTA) {
                 uint64_t u64;
                 uint8_t frac_width = flavic48::simple_decode_single(data_pos, &u64);
@@ -2561,6 +3256,13 @@ class builder : public builder_fwd {
                   delta_val -= prev_val;
                 prev_val = col_val;
                 prev_val_node_id = node_id;
+                // each checkpoint holds the value of the last leaf before its sub-block
+                uint32_t ckpt_node_id = node_id - (pk_col_count > 0 ? 0 : 1);
+                size_t ckpt_idx = (ckpt_node_id / nodes_per_bv_block_n) * MDX_DELTA_CKPTS_PER_BLOCK;
+                if (delta_ckpts.size() < ckpt_idx + MDX_DELTA_CKPTS_PER_BLOCK)
+                  delta_ckpts.resize(ckpt_idx + MDX_DELTA_CKPTS_PER_BLOCK, 0);
+                for (size_t s = (ckpt_node_id % nodes_per_bv_block_n) / MDX_DELTA_CKPT_NODES; s < MDX_DELTA_CKPTS_PER_BLOCK; s++)
+                  delta_ckpts[ckpt_idx + s] = col_val;
                 // printf("Node id: %u, delta value: %lld\n", node_id, delta_val);
                 u64 = flavic48::cvt2_u64(delta_val);
                 uint8_t v64[10];
@@ -2589,6 +3291,7 @@ class builder : public builder_fwd {
         }
       }
       builder *rev_col_trie_bldr = nullptr;
+      byte_vec postings;
       if (encoding_type == MSE_TRIE || encoding_type == MSE_TRIE_2WAY) {
         // fclose(col_trie_fp);
         if (encoding_type == MSE_TRIE_2WAY) {
@@ -2597,13 +3300,15 @@ class builder : public builder_fwd {
           ctb_opts.leap_frog = true;
           rev_col_trie_bldr = new builder(NULL, "rev_col_trie,key", 1, "*", "*", 0, 1, ctb_opts);
         }
-        uint32_t col_trie_size = build_col_trie(all_vals, rev_col_trie_bldr);
+        uint32_t col_trie_size = build_col_trie(all_vals, rev_col_trie_bldr,
+                  encoding_type == MSE_TRIE_2WAY ? &postings : nullptr);
         ptr_groups *ptr_grps = tail_vals.get_val_grp_ptrs();
         ptr_grps->set_max_len(col_trie->max_key_len);
         ptr_grps->build(memtrie.node_count, memtrie.all_node_sets, ptr_groups::get_vals_info_fn, 
             uniq_vals_fwd, false, pk_col_count, opts.dessicate, encoding_type, col_trie_size);
       } else {
         val_sort_callbacks val_sort_cb(memtrie.all_node_sets, *all_vals, uniq_vals);
+        val_sort_cb.thread_count = opts.thread_count;
         uint32_t tot_freq_count = uniq_maker::sort_and_reduce(nodes_for_sort, *all_vals,
                     uniq_vals, uniq_vals_fwd, val_sort_cb, max_val_len, 0, data_type);
 
@@ -2623,16 +3328,30 @@ class builder : public builder_fwd {
             uniq_vals_fwd, false, pk_col_count, opts.dessicate, encoding_type);
       }
 
+      byte_vec zone_map;
+      for (size_t i = 0; i < zones.size(); i++) {
+        gen::append_uint64((uint64_t) zones[i].min_val, zone_map);
+        gen::append_uint64((uint64_t) zones[i].max_val, zone_map);
+        gen::append_uint32(zones[i].null_count, zone_map);
+        gen::append_uint32(0, zone_map);
+      }
+      size_t rev_col_trie_size = 0;
+      if (rev_col_trie_bldr != nullptr) {
+        printf("Building reverse col_trie: \n");
+        rev_col_trie_size = rev_col_trie_bldr->build();
+        printf("Reverse col_trie size: %lu\n", rev_col_trie_size);
+      }
+      ptr_groups *val_ptr_grps = tail_vals.get_val_grp_ptrs();
+      val_ptr_grps->set_col_aux(delta_ckpts, zone_map, postings, rev_col_trie_size);
       uint32_t val_size = write_val_ptrs_data(data_type, encoding_type, 1, fp, out_vec); // TODO: fix flags
       if (encoding_type == MSE_TRIE || encoding_type == MSE_TRIE_2WAY) {
         col_trie_builder->write_trie(NULL);
         if (rev_col_trie_bldr != nullptr) {
-          printf("Building reverse col_trie: \n");
-          size_t rev_col_trie_size = rev_col_trie_bldr->build();
-          val_size += rev_col_trie_size;
-          printf("Reverse col_trie size: %lu\n", rev_col_trie_size);
+          val_size += gen::size_align8(rev_col_trie_size);
           rev_col_trie_bldr->write_trie(NULL);
+          output_align8(rev_col_trie_size, fp, out_vec);
         }
+        val_ptr_grps->write_col_aux(fp, out_vec);
       }
 
       if (delta_vals != nullptr)
@@ -2754,6 +3473,7 @@ class builder : public builder_fwd {
     uint32_t build_trie() {
       clock_t t = clock();
       tail_sort_callbacks tail_sort_cb(memtrie.all_node_sets, *memtrie.all_tails, uniq_tails);
+      tail_sort_cb.thread_count = opts.thread_count;
       uint32_t tot_freq_count = uniq_maker::make_uniq(memtrie.all_node_sets, *memtrie.all_tails,
           uniq_tails, uniq_tails_rev, tail_sort_cb, memtrie.max_tail_len, trie_level, 0, 0, MST_BIN);
       uint32_t tail_trie_size = 0;
@@ -2776,6 +3496,7 @@ class builder : public builder_fwd {
       uint64_t bm_child = 0;
       uint64_t bm_ptr = 0;
       uint64_t bm_mask = bm_init_mask;
+      uint32_t inline_ranks[4] = {0, 0, 0, 0};
       byte_vec byte_vec64;
       //trie.reserve(node_count + (node_count >> 1));
       uint32_t ptr_count = 0;
@@ -2815,6 +3536,8 @@ class builder : public builder_fwd {
             append64_t(trie_flags, bm_term);
             append64_t(trie_flags, bm_child);
             append64_t(trie_flags, bm_leaf);
+            if (opts.inline_rank)
+              append_inline_ranks(trie_flags, inline_ranks, bm_ptr, bm_term, bm_child, bm_leaf);
           } else
             append64_t(trie_flags_tail, bm_ptr);
           append_byte_vec(trie, byte_vec64);
@@ -2869,6 +3592,8 @@ class builder : public builder_fwd {
         append64_t(trie_flags, bm_term);
         append64_t(trie_flags, bm_child);
         append64_t(trie_flags, bm_leaf);
+        if (opts.inline_rank)
+          append_inline_ranks(trie_flags, inline_ranks, bm_ptr, bm_term, bm_child, bm_leaf);
       } else
         append64_t(trie_flags_tail, bm_ptr);
       append_byte_vec(trie, byte_vec64);
@@ -2919,10 +3644,82 @@ class builder : public builder_fwd {
       return tail_vals.get_uniq_vals_fwd()->size();
     }
 
+    // Returns false once insert_sorted() has been used, as the node sets
+    // on the path of the last sorted key are not in memtrie yet
     bool insert(const uint8_t *key, int key_len, uint32_t val_pos = UINT32_MAX) {
+      if (sorted_maker != NULL)
+        return false;
       return memtrie.insert(key, key_len, val_pos);
     }
 
+    // Records inserted with primary keys are buffered up to budget bytes and then
+    // spilled to tmp_dir as sorted runs, which are merged in key order at build()
+    // into one more file, from which each column is loaded only while it is built
+    void set_mem_budget(size_t budget, const char *tmp_dir = "/tmp") {
+      if (ext_sort != NULL)
+        delete ext_sort;
+      ext_sort = (budget == 0 ? NULL : new ext_sorter(budget, tmp_dir));
+    }
+
+    // Version 1 has 32-bit section locations. Version 2 is used anyway
+    // when the index crosses 4 GB
+    void set_hdr_version(uint8_t version) {
+      hdr_version = version;
+    }
+
+    // Aligns the start and end of the caches, rank/select lts and trie_flags
+    // of the key trie, for example to 2 MB so they can be mapped on hugepages
+    void set_section_align(uint32_t align) {
+      section_align = align;
+    }
+
+    // Stores min, max and null count of numeric columns every MDX_ZONE_ROWS rows,
+    // so that static_trie_map::scan_where() can skip blocks
+    void set_zone_maps(bool to_enable = true) {
+      zone_maps_enabled = to_enable;
+    }
+
+    struct col_zone {
+      int64_t min_val;
+      int64_t max_val;
+      uint32_t null_count;
+    };
+    void add_to_zone(std::vector<col_zone>& zones, uint32_t row, uint8_t *data_pos) {
+      size_t zone_idx = row / MDX_ZONE_ROWS;
+      while (zones.size() <= zone_idx)
+        zones.push_back((col_zone) {INT64_MAX, INT64_MIN, 0});
+      col_zone& zone = zones[zone_idx];
+      if (*data_pos == 0xF8) {
+        zone.null_count++;
+        return;
+      }
+      uint64_t u64;
+      flavic48::simple_decode_single(data_pos, &u64);
+      int64_t col_val = flavic48::cvt2_i64(u64);
+      if (zone.min_val > col_val)
+        zone.min_val = col_val;
+      if (zone.max_val < col_val)
+        zone.max_val = col_val;
+    }
+
+    long get_peak_rss_kb() {
+      struct rusage usage;
+      if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+      return usage.ru_maxrss;
+    }
+
+    // Faster path for keys given in ascending order, cannot be mixed with insert()
+    // Returns false if key is not greater than the previous key
+    bool insert_sorted(const uint8_t *key, int key_len, uint32_t val_pos = UINT32_MAX) {
+      if (sorted_maker == NULL) {
+        if (memtrie.key_count > 0)
+          return false;
+        sorted_maker = new sorted_trie_maker(memtrie);
+      }
+      return sorted_maker->add(key, key_len, val_pos);
+    }
+
     void set_leaf_seq(uint32_t ns_id, uint32_t& seq_idx, std::function<void(uint32_t, uint32_t)> set_seq) {
       leopard::node_set_handler ns(memtrie.all_node_sets, ns_id);
       leopard::node n = ns.first_node();
@@ -3057,6 +3854,14 @@ class builder : public builder_fwd {
         uint32_t node_freq = build_cache(which, n.get_child(), cur_node_id, cache_mask, tail_from0);
         tail_from0.set_length(parent_tail_len);
         freq_count += node_freq;
+        if (has_ns_profile && trie_level == 0) {
+          // paths seen in the query profile instead of subtree counts
+          if (n.get_child() > 0) {
+            leopard::node_set_handler child_nsh(memtrie.all_node_sets, n.get_child());
+            node_freq = child_nsh.hdr()->freq;
+          } else
+            node_freq = ns.hdr()->freq;
+        }
         if (n.get_child() > 0 && (n.get_flags() & NFLAG_TAIL) == 0) {
           uint8_t node_byte = n.get_byte();
           leopard::node_set_handler child_nsh(memtrie.all_node_sets, n.get_child());
@@ -3174,14 +3979,115 @@ class builder : public builder_fwd {
       }
     }
 
-    uint32_t build() {
+    // Assigns the location of each section from the sizes worked out in build()
+    // Version 2 headers are bigger, so all locations move when the version changes
+    void set_section_locs() {
+      tp.opts_loc = (hdr_version < 2 ? MDX_HDR_V1_SIZE : MDX_HDR_V2_SIZE);
+      if (pk_col_count > 0) {
+        tp.fwd_cache_loc = tp.opts_loc + tp.opts_size;
+        if (section_align > 0 && trie_level == 0) {
+          tp.core_start_pad = (section_align - tp.fwd_cache_loc % section_align) % section_align;
+          tp.fwd_cache_loc += tp.core_start_pad;
+        }
+        tp.rev_cache_loc = tp.fwd_cache_loc + tp.fwd_cache_size;
+        tp.sec_cache_loc = tp.rev_cache_loc + gen::size_align8(tp.rev_cache_size);
+
+        if (trie_level == 0) {
+          tp.child_select_lkup_loc = tp.sec_cache_loc + tp.sec_cache_size;
+          tp.term_select_lkup_loc = tp.child_select_lkup_loc + gen::size_align8(tp.child_select_lt_sz);
+          uint32_t total_rank_lt_size = tp.term_rank_lt_sz + tp.child_rank_lt_sz + tp.tail_rank_lt_sz;
+          tp.term_rank_lt_loc = tp.term_select_lkup_loc + gen::size_align8(tp.term_select_lt_sz);
+          tp.child_rank_lt_loc = tp.term_rank_lt_loc + width_of_bv_block;
+          tp.trie_flags_loc = tp.term_rank_lt_loc + gen::size_align8(total_rank_lt_size);
+          if (opts.inline_rank) {
+            tp.trie_flags_pad = (64 - tp.trie_flags_loc % 64) % 64;
+            tp.trie_flags_loc += tp.trie_flags_pad;
+          }
+          tp.tail_rank_lt_loc = tp.tail_rank_lt_sz == 0 ? 0 : tp.term_rank_lt_loc + width_of_bv_block * 2;
+          tp.louds_rank_lt_loc = tp.term_rank_lt_loc; // dummy
+          tp.louds_sel1_lt_loc = tp.term_select_lkup_loc; // dummy
+          tp.trie_tail_ptrs_data_loc = tp.trie_flags_loc + trie_flags.size();
+          if (section_align > 0) {
+            tp.core_end_pad = (section_align - tp.trie_tail_ptrs_data_loc % section_align) % section_align;
+            tp.trie_tail_ptrs_data_loc += tp.core_end_pad;
+          }
+        } else {
+          tp.louds_sel1_lt_loc = tp.sec_cache_loc + tp.sec_cache_size;
+          tp.louds_rank_lt_loc = tp.louds_sel1_lt_loc + gen::size_align8(tp.louds_sel1_lt_sz);
+          tp.trie_flags_loc = tp.louds_rank_lt_loc + gen::size_align8(tp.louds_rank_lt_sz);
+          tp.tail_rank_lt_loc = tp.trie_flags_loc + louds.size_bytes();
+          tp.term_rank_lt_loc = tp.child_rank_lt_loc = gen::size_align8(tp.louds_rank_lt_loc); // All point to louds
+          tp.term_select_lkup_loc = tp.child_select_lkup_loc = gen::size_align8(tp.louds_sel1_lt_loc); // All point to louds
+          tp.trie_tail_ptrs_data_loc = tp.tail_rank_lt_loc + gen::size_align8(tp.tail_rank_lt_sz);
+        }
+
+        tp.leaf_rank_lt_loc = tp.trie_tail_ptrs_data_loc + tp.trie_tail_ptrs_data_sz;
+        tp.tail_flags_loc = tp.leaf_rank_lt_loc + gen::size_align8(tp.leaf_rank_lt_sz);
+        tp.leaf_select_lkup_loc = tp.tail_flags_loc + trie_flags_tail.size();
+
+        if (!opts.leap_frog)
+          tp.sec_cache_loc = 0;
+      } else
+        tp.leaf_select_lkup_loc = tp.opts_loc + tp.opts_size;
+
+      tp.hot_ns_loc = tp.hot_ns_sz == 0 ? 0 : tp.leaf_select_lkup_loc + gen::size_align8(tp.leaf_select_lt_sz);
+      tp.names_loc = tp.leaf_select_lkup_loc + gen::size_align8(tp.leaf_select_lt_sz) + tp.hot_ns_sz;
+      tp.names_sz = (column_count + 2) * sizeof(uint16_t) + names_len;
+      tp.col_val_table_loc = tp.names_loc + gen::size_align8(tp.names_sz);
+      int val_count = column_count;
+      tp.col_val_table_sz = val_count * sizeof(uint64_t);
+      tp.null_val_loc = tp.col_val_table_loc + gen::size_align8(tp.col_val_table_sz);
+      tp.empty_val_loc = tp.null_val_loc + 16;
+      tp.col_val_loc0 = tp.empty_val_loc + 16;
+      tp.total_idx_size = tp.opts_loc + tp.opts_size +
+                (trie_level > 0 ? louds.size_bytes() : trie_flags.size() + tp.trie_flags_pad) +
+                trie_flags_tail.size() +
+                tp.fwd_cache_size + gen::size_align8(tp.rev_cache_size) + tp.sec_cache_size +
+                (trie_level == 0 ? (gen::size_align8(tp.child_select_lt_sz) +
+                     gen::size_align8(tp.term_select_lt_sz + tp.term_rank_lt_sz + tp.child_rank_lt_sz)) :
+                  (gen::size_align8(tp.louds_sel1_lt_sz) + gen::size_align8(tp.louds_rank_lt_sz))) +
+                gen::size_align8(tp.leaf_select_lt_sz) +
+                gen::size_align8(tp.leaf_rank_lt_sz) + gen::size_align8(tp.tail_rank_lt_sz) + tp.hot_ns_sz +
+                gen::size_align8(tp.names_sz) + gen::size_align8(tp.col_val_table_sz) + 32;
+      if (pk_col_count > 0)
+        tp.total_idx_size += trie_data_ptr_size() + tp.core_start_pad + tp.core_end_pad;
+    }
+
+    uint64_t build() {
 
       clock_t t = clock();
 
+      if (ext_sort != NULL) {
+        ext_recs = ext_sort->create_tmp_file();
+        uint32_t rec_seq = 0;
+        ext_sort->merge([this, &rec_seq](const uint8_t *key, uint32_t key_len, const uint8_t *rec, uint32_t rec_len) {
+          // keys come sorted and unique, so only an empty key is refused
+          if (!insert_sorted(key, key_len, rec_seq)) {
+            printf("Record with empty key skipped\n");
+            return;
+          }
+          if (fwrite(&rec_len, sizeof(uint32_t), 1, ext_recs) != 1 || fwrite(rec, 1, rec_len, ext_recs) != rec_len) {
+            printf("Error writing merged records: %d\n", errno);
+            throw errno;
+          }
+          rec_pos_vec.push_back(rec_seq++);
+        });
+        ext_col_pos.resize(rec_seq);
+        gen::gen_printf("Runs merged: %lu, spilled: %lu bytes\n", ext_sort->get_run_count(), ext_sort->get_spilled_size());
+        delete ext_sort;
+        ext_sort = NULL;
+        t = gen::print_time_taken(t, "Time taken for merging runs: ");
+      }
+
+      if (sorted_maker != NULL) {
+        sorted_maker->finish();
+        delete sorted_maker;
+        sorted_maker = NULL;
+      }
+
       gen::gen_printf("Key count: %u\n", memtrie.key_count);
 
       tp = {};
-      tp.opts_loc = 4 + 12 + 30 * 4; // 136
       tp.opts_size = sizeof(bldr_options);
 
       if (pk_col_count > 0) {
@@ -3189,6 +4095,8 @@ class builder : public builder_fwd {
           split_tails();
         sort_node_sets();
         set_node_id();
+        if (hot_ns_count > 0)
+          build_hot_child_bm();
         set_level(1, 1);
         tp.min_stats = make_min_positions();
         tp.trie_tail_ptrs_data_sz = build_trie();
@@ -3197,9 +4105,15 @@ class builder : public builder_fwd {
           opts.fwd_cache = false;
           opts.rev_cache = true;
         }
+        // fwd and rev caches only read memtrie, so they can be built together
+        std::thread fwd_cache_thread;
         if (opts.fwd_cache) {
-          tp.fwd_cache_count = build_cache(CACHE_FWD, tp.fwd_cache_max_node_id);
-          tp.fwd_cache_size = tp.fwd_cache_count * 8; // 8 = parent_node_id (3) + child_node_id (3) + node_offset (1) + node_byte (1)
+          if (opts.thread_count > 1 && opts.rev_cache)
+            fwd_cache_thread = std::thread([this]() {
+              tp.fwd_cache_count = build_cache(CACHE_FWD, tp.fwd_cache_max_node_id);
+            });
+          else
+            tp.fwd_cache_count = build_cache(CACHE_FWD, tp.fwd_cache_max_node_id);
         } else
           tp.fwd_cache_max_node_id = 0;
         if (opts.rev_cache) {
@@ -3207,6 +4121,10 @@ class builder : public builder_fwd {
           tp.rev_cache_size = tp.rev_cache_count * 12; // 6 = parent_node_id (3) + child_node_id (3)
         } else
           tp.rev_cache_max_node_id = 0;
+        if (fwd_cache_thread.joinable())
+          fwd_cache_thread.join();
+        if (opts.fwd_cache)
+          tp.fwd_cache_size = tp.fwd_cache_count * 8; // 8 = parent_node_id (3) + child_node_id (3) + node_offset (1) + node_byte (1)
         tp.sec_cache_count = decide_min_stat_to_use(tp.min_stats);
         tp.sec_cache_size = 0;
         if (opts.leap_frog)
@@ -3245,62 +4163,22 @@ class builder : public builder_fwd {
           tp.leaf_rank_lt_sz = 0;
         }
 
-        tp.fwd_cache_loc = tp.opts_loc + tp.opts_size;
-        tp.rev_cache_loc = tp.fwd_cache_loc + tp.fwd_cache_size;
-        tp.sec_cache_loc = tp.rev_cache_loc + gen::size_align8(tp.rev_cache_size);
-
-        if (trie_level == 0) {
-          tp.child_select_lkup_loc = tp.sec_cache_loc + tp.sec_cache_size;
-          tp.term_select_lkup_loc = tp.child_select_lkup_loc + gen::size_align8(tp.child_select_lt_sz);
-          uint32_t total_rank_lt_size = tp.term_rank_lt_sz + tp.child_rank_lt_sz + tp.tail_rank_lt_sz;
-          tp.term_rank_lt_loc = tp.term_select_lkup_loc + gen::size_align8(tp.term_select_lt_sz);
-          tp.child_rank_lt_loc = tp.term_rank_lt_loc + width_of_bv_block;
-          tp.trie_flags_loc = tp.term_rank_lt_loc + gen::size_align8(total_rank_lt_size);
-          tp.tail_rank_lt_loc = tp.tail_rank_lt_sz == 0 ? 0 : tp.term_rank_lt_loc + width_of_bv_block * 2;
-          tp.louds_rank_lt_loc = tp.term_rank_lt_loc; // dummy
-          tp.louds_sel1_lt_loc = tp.term_select_lkup_loc; // dummy
-          tp.trie_tail_ptrs_data_loc = tp.trie_flags_loc + trie_flags.size();
-        } else {
-          tp.louds_sel1_lt_loc = tp.sec_cache_loc + tp.sec_cache_size;
-          tp.louds_rank_lt_loc = tp.louds_sel1_lt_loc + gen::size_align8(tp.louds_sel1_lt_sz);
-          tp.trie_flags_loc = tp.louds_rank_lt_loc + gen::size_align8(tp.louds_rank_lt_sz);
-          tp.tail_rank_lt_loc = tp.trie_flags_loc + louds.size_bytes();
-          tp.term_rank_lt_loc = tp.child_rank_lt_loc = gen::size_align8(tp.louds_rank_lt_loc); // All point to louds
-          tp.term_select_lkup_loc = tp.child_select_lkup_loc = gen::size_align8(tp.louds_sel1_lt_loc); // All point to louds
-          tp.trie_tail_ptrs_data_loc = tp.tail_rank_lt_loc + gen::size_align8(tp.tail_rank_lt_sz);
+        if (hot_ns_count > 0) {
+          tp.hot_rank_lt_sz = gen::get_lkup_tbl_size2(hot_node_count, nodes_per_bv_block, width_of_bv_block);
+          tp.hot_select_lt_sz = gen::get_lkup_tbl_size2(hot_child_count + 1, sel_divisor, 3);
+          tp.cold_select_lt_sz = gen::get_lkup_tbl_size2(cold_child_count + 1, sel_divisor, 3);
+          tp.hot_ns_sz = 40 + hot_child_bm.size() * sizeof(uint64_t) * 2 +
+                gen::size_align8(tp.hot_rank_lt_sz) * 2 +
+                gen::size_align8(tp.hot_select_lt_sz) + gen::size_align8(tp.cold_select_lt_sz);
         }
-
-        tp.leaf_rank_lt_loc = tp.trie_tail_ptrs_data_loc + tp.trie_tail_ptrs_data_sz;
-        tp.tail_flags_loc = tp.leaf_rank_lt_loc + gen::size_align8(tp.leaf_rank_lt_sz);
-        tp.leaf_select_lkup_loc = tp.tail_flags_loc + trie_flags_tail.size();
-
-        if (!opts.leap_frog)
-          tp.sec_cache_loc = 0;
-      } else {
-        tp.leaf_select_lkup_loc = tp.opts_loc + tp.opts_size;
+      } else
         tp.leaf_select_lt_sz = 0;
-      }
 
-      tp.names_loc = tp.leaf_select_lkup_loc + gen::size_align8(tp.leaf_select_lt_sz);
-      tp.names_sz = (column_count + 2) * sizeof(uint16_t) + names_len;
-      tp.col_val_table_loc = tp.names_loc + gen::size_align8(tp.names_sz);
-      int val_count = column_count;
-      tp.col_val_table_sz = val_count * sizeof(uint64_t);
-      tp.null_val_loc = tp.col_val_table_loc + gen::size_align8(tp.col_val_table_sz);
-      tp.empty_val_loc = tp.null_val_loc + 16;
-      tp.col_val_loc0 = tp.empty_val_loc + 16;
-      tp.total_idx_size = tp.opts_loc + tp.opts_size +
-                (trie_level > 0 ? louds.size_bytes() : trie_flags.size()) +
-                trie_flags_tail.size() +
-                tp.fwd_cache_size + gen::size_align8(tp.rev_cache_size) + tp.sec_cache_size +
-                (trie_level == 0 ? (gen::size_align8(tp.child_select_lt_sz) +
-                     gen::size_align8(tp.term_select_lt_sz + tp.term_rank_lt_sz + tp.child_rank_lt_sz)) :
-                  (gen::size_align8(tp.louds_sel1_lt_sz) + gen::size_align8(tp.louds_rank_lt_sz))) +
-                gen::size_align8(tp.leaf_select_lt_sz) +
-                gen::size_align8(tp.leaf_rank_lt_sz) + gen::size_align8(tp.tail_rank_lt_sz) +
-                gen::size_align8(tp.names_sz) + gen::size_align8(tp.col_val_table_sz) + 32;
-      if (pk_col_count > 0)
-        tp.total_idx_size += trie_data_ptr_size();
+      set_section_locs();
+      if (hdr_version < 2 && tp.total_idx_size > UINT32_MAX) {
+        hdr_version = 2;
+        set_section_locs();
+      }
 
       // if (opts.dessicate) {
       //   tp.term_select_lkup_loc = tp.term_rank_lt_loc = tp.child_rank_lt_loc = 0;
@@ -3325,7 +4203,7 @@ class builder : public builder_fwd {
         throw errno;
     }
 
-    uint32_t write_trie(const char *filename = NULL) {
+    uint64_t write_trie(const char *filename = NULL) {
 
       if (tp.names_loc == 0)
         build();
@@ -3347,19 +4225,33 @@ class builder : public builder_fwd {
       if (fp == nullptr)
         out_vec->reserve(tp.total_idx_size);
 
+      uint64_t hdr_locs[MDX_HDR_LOC_COUNT] = {tp.names_loc, tp.col_val_table_loc, tp.opts_loc,
+          tp.fwd_cache_loc, tp.rev_cache_loc, tp.sec_cache_loc,
+          trie_level == 0 ? tp.term_select_lkup_loc : tp.louds_sel1_lt_loc,
+          trie_level == 0 ? tp.term_rank_lt_loc : tp.louds_rank_lt_loc,
+          trie_level == 0 ? tp.child_select_lkup_loc : tp.louds_sel1_lt_loc,
+          trie_level == 0 ? tp.child_rank_lt_loc : tp.louds_rank_lt_loc,
+          tp.leaf_select_lkup_loc, tp.leaf_rank_lt_loc, tp.tail_rank_lt_loc, tp.trie_tail_ptrs_data_loc,
+          tp.louds_rank_lt_loc, tp.louds_sel1_lt_loc, tp.trie_flags_loc, tp.tail_flags_loc,
+          tp.null_val_loc, tp.empty_val_loc, tp.hot_ns_loc};
+      // version 2 leaves the u32 locations as 0 and appends all of them as u64
+      std::function<void(int)> output_loc = [this, &hdr_locs](int loc_idx) {
+        output_u32(hdr_version < 2 ? hdr_locs[loc_idx] : 0, fp, out_vec);
+      };
+
       output_byte(0xA5, fp, out_vec); // magic byte
-      output_byte(0x01, fp, out_vec); // version 1.0
+      output_byte(hdr_version, fp, out_vec); // version 1.0 or 2.0
       output_byte(0, fp, out_vec); // reserved
       output_byte(0, fp, out_vec);
 
       int val_count = column_count;
       output_u32(val_count, fp, out_vec);
 
-      output_u32(tp.names_loc, fp, out_vec);
-      output_u32(tp.col_val_table_loc, fp, out_vec);
+      output_loc(MDX_HDR_NAMES);
+      output_loc(MDX_HDR_COL_VAL_TBL);
 
       output_u32(memtrie.node_count, fp, out_vec);
-      output_u32(tp.opts_loc, fp, out_vec);
+      output_loc(MDX_HDR_OPTS);
       output_u32(memtrie.node_set_count, fp, out_vec);
       output_u32(memtrie.key_count, fp, out_vec);
       output_u32(memtrie.max_key_len, fp, out_vec);
@@ -3371,36 +4263,21 @@ class builder : public builder_fwd {
       output_u32(tp.fwd_cache_max_node_id, fp, out_vec);
       output_u32(tp.rev_cache_max_node_id, fp, out_vec);
       output_bytes((const uint8_t *) &tp.min_stats, 4, fp, out_vec);
-      output_u32(tp.fwd_cache_loc, fp, out_vec);
-      output_u32(tp.rev_cache_loc, fp, out_vec);
-      output_u32(tp.sec_cache_loc, fp, out_vec);
-
-      if (trie_level == 0) {
-        output_u32(tp.term_select_lkup_loc, fp, out_vec);
-        output_u32(tp.term_rank_lt_loc, fp, out_vec);
-        output_u32(tp.child_select_lkup_loc, fp, out_vec);
-        output_u32(tp.child_rank_lt_loc, fp, out_vec);
-      } else {
-        output_u32(tp.louds_sel1_lt_loc, fp, out_vec);
-        output_u32(tp.louds_rank_lt_loc, fp, out_vec);
-        output_u32(tp.louds_sel1_lt_loc, fp, out_vec);
-        output_u32(tp.louds_rank_lt_loc, fp, out_vec);
-      }
-      output_u32(tp.leaf_select_lkup_loc, fp, out_vec);
-      output_u32(tp.leaf_rank_lt_loc, fp, out_vec);
-      output_u32(tp.tail_rank_lt_loc, fp, out_vec);
-      output_u32(tp.trie_tail_ptrs_data_loc, fp, out_vec);
-      output_u32(tp.louds_rank_lt_loc, fp, out_vec);
-      output_u32(tp.louds_sel1_lt_loc, fp, out_vec);
-      output_u32(tp.trie_flags_loc, fp, out_vec);
-      output_u32(tp.tail_flags_loc, fp, out_vec);
-      output_u32(tp.null_val_loc, fp, out_vec);
-      output_u32(tp.empty_val_loc, fp, out_vec);
-      output_u32(0, fp, out_vec); // padding
+      for (int i = MDX_HDR_FWD_CACHE; i < MDX_HDR_LOC_COUNT; i++)
+        output_loc(i);
+      if (hdr_version >= 2) {
+        for (int i = 0; i < MDX_HDR_LOC_COUNT; i++)
+          output_u64(hdr_locs[i], fp, out_vec);
+      }
 
-      output_bytes((const uint8_t *) &opts, tp.opts_size, fp, out_vec);
+      // thread_count only affects the build, so the output does not depend on it
+      bldr_options out_opts = opts;
+      out_opts.thread_count = 0;
+      output_bytes((const uint8_t *) &out_opts, tp.opts_size, fp, out_vec);
 
       if (pk_col_count > 0) {
+        for (size_t i = 0; i < tp.core_start_pad; i++)
+          output_byte(0, fp, out_vec);
         write_fwd_cache();
         write_rev_cache();
         if (tp.sec_cache_size > 0)
@@ -3420,8 +4297,13 @@ class builder : public builder_fwd {
           output_bytes((const uint8_t *) louds.raw_data()->data(), louds.raw_data()->size() * sizeof(uint64_t), fp, out_vec);
           if (tp.tail_rank_lt_sz > 0)
             write_bv_rank_lt(BV_LT_TYPE_TAIL, tp.tail_rank_lt_sz);
-        } else
+        } else {
+          for (size_t i = 0; i < tp.trie_flags_pad; i++)
+            output_byte(0, fp, out_vec);
           output_bytes(trie_flags.data(), trie_flags.size(), fp, out_vec);
+          for (size_t i = 0; i < tp.core_end_pad; i++)
+            output_byte(0, fp, out_vec);
+        }
 
         write_trie_tail_ptrs_data(fp, out_vec);
 
@@ -3432,6 +4314,8 @@ class builder : public builder_fwd {
           if (opts.leaf_lt && opts.trie_leaf_count > 0)
             write_bv_select_lt(BV_LT_TYPE_LEAF, tp.leaf_select_lt_sz);
         // }
+        if (tp.hot_ns_sz > 0)
+          write_hot_ns();
       }
 
       val_table[0] = tp.col_val_loc0;
@@ -3452,7 +4336,7 @@ class builder : public builder_fwd {
       // fclose(fp);
 
       gen::print_time_taken(t, "Time taken for write_trie(): ");
-      gen::gen_printf("Idx size: %u\n", tp.total_idx_size);
+      gen::gen_printf("Idx size: %lu\n", tp.total_idx_size);
 
       actual_trie_size = fp == nullptr ? out_vec->size() : (ftell(fp) - actual_trie_size);
       if (fp == nullptr && trie_level > 0)
@@ -3476,7 +4360,7 @@ class builder : public builder_fwd {
           cur_col_idx++;
           continue;
         }
-        if (all_vals->size() > 2 || encoding_type == MSE_TRIE || encoding_type == MSE_TRIE_2WAY || encoding_type == 'w') { // TODO: What if column contains only NULL and ""
+        if (all_vals->size() > 2 || ext_recs != NULL || encoding_type == MSE_TRIE || encoding_type == MSE_TRIE_2WAY || encoding_type == 'w') { // TODO: What if column contains only NULL and ""
           uint32_t val_size = build_col_val();
           val_table[cur_col_idx] = prev_val_loc;
           prev_val_loc += val_size;
@@ -3485,7 +4369,8 @@ class builder : public builder_fwd {
         }
       }
       write_final_val_table();
-      gen::gen_printf("Total size: %u\n", prev_val_loc);
+      gen::gen_printf("Total size: %lu\n", prev_val_loc);
+      gen::gen_printf("Peak RSS: %ld KB\n", get_peak_rss_kb());
       close_file();
     }
 
@@ -3513,7 +4398,7 @@ class builder : public builder_fwd {
     void write_final_val_table() {
       if (fp == NULL) {
         for (size_t i = 0; i < column_count; i++)
-          gen::copy_uint32(val_table[i], out_vec->data() + tp.col_val_table_loc + i * 4);
+          memcpy(out_vec->data() + tp.col_val_table_loc + i * sizeof(uint64_t), &val_table[i], sizeof(uint64_t));
       } else {
         fseek(fp, tp.col_val_table_loc, SEEK_SET);
         write_col_val_table();
@@ -3521,11 +4406,11 @@ class builder : public builder_fwd {
       int val_count = column_count;
       gen::gen_printf("Val count: %d, tbl:", val_count);
       for (int i = 0; i < val_count; i++)
-        gen::gen_printf(" %u", val_table[i]);
+        gen::gen_printf(" %lu", val_table[i]);
       gen::gen_printf("\nCol sizes:");
-      uint32_t total_size = val_table[0];
+      uint64_t total_size = val_table[0];
       for (int i = 1; i < val_count; i++) {
-        gen::gen_printf(" %u", val_table[i] - val_table[i - 1]);
+        gen::gen_printf(" %lu", val_table[i] - val_table[i - 1]);
         total_size += val_table[i];
       }
       gen::gen_printf("\n");
@@ -3640,6 +4525,68 @@ class builder : public builder_fwd {
       output_align8(rank_lt_sz, fp, out_vec);
     }
 
+    void write_bm_rank_lt(std::vector<uint64_t>& bm, size_t bit_count, size_t rank_lt_sz) {
+      uint32_t count = 0;
+      uint32_t count_n = 0;
+      int u8_arr_count = (nodes_per_bv_block / nodes_per_bv_block_n);
+      uint16_t bit_counts_n[u8_arr_count];
+      uint8_t pos_n = 1;
+      memset(bit_counts_n, 0xFF, u8_arr_count * sizeof(uint16_t));
+      bit_counts_n[0] = 0x1E;
+      for (size_t i = 0; i < bit_count; i++) {
+        write_bv_n(i, true, count, count_n, bit_counts_n, pos_n);
+        count_n += ((bm[i / nodes_per_bv_block_n] >> (i % nodes_per_bv_block_n)) & 1);
+      }
+      bit_count = nodes_per_bv_block; // just to make it write last blocks
+      write_bv_n(bit_count, true, count, count_n, bit_counts_n, pos_n);
+      write_bv_n(bit_count, true, count, count_n, bit_counts_n, pos_n);
+      output_align8(rank_lt_sz, fp, out_vec);
+    }
+
+    void write_bm_select_lt(std::vector<uint64_t>& bm, size_t bit_count, size_t sel_lt_sz) {
+      uint32_t one_count = 0;
+      output_u24(0, fp, out_vec);
+      for (size_t i = 0; i < bit_count; i++) {
+        if ((bm[i / nodes_per_bv_block_n] >> (i % nodes_per_bv_block_n)) & 1) {
+          one_count++;
+          if (one_count && (one_count % sel_divisor) == 0) {
+            uint32_t val_to_write = i / nodes_per_bv_block;
+            output_u24(val_to_write, fp, out_vec);
+          }
+        }
+      }
+      output_u24(bit_count / nodes_per_bv_block, fp, out_vec);
+      output_align8(sel_lt_sz, fp, out_vec);
+    }
+
+    // Hot region header: hot ns count, hot node count, cold child count and
+    // offsets of hot select, hot rank, cold select, cold rank, hot bm, cold bm
+    void write_hot_ns() {
+      uint32_t bm_sz = hot_child_bm.size() * sizeof(uint64_t);
+      uint32_t hot_select_loc = 40;
+      uint32_t hot_rank_loc = hot_select_loc + gen::size_align8(tp.hot_select_lt_sz);
+      uint32_t cold_select_loc = hot_rank_loc + gen::size_align8(tp.hot_rank_lt_sz);
+      uint32_t cold_rank_loc = cold_select_loc + gen::size_align8(tp.cold_select_lt_sz);
+      uint32_t hot_bm_loc = cold_rank_loc + gen::size_align8(tp.hot_rank_lt_sz);
+      uint32_t cold_bm_loc = hot_bm_loc + bm_sz;
+      output_u32(hot_ns_count, fp, out_vec);
+      output_u32(hot_node_count, fp, out_vec);
+      output_u32(cold_child_count, fp, out_vec);
+      output_u32(hot_select_loc, fp, out_vec);
+      output_u32(hot_rank_loc, fp, out_vec);
+      output_u32(cold_select_loc, fp, out_vec);
+      output_u32(cold_rank_loc, fp, out_vec);
+      output_u32(hot_bm_loc, fp, out_vec);
+      output_u32(cold_bm_loc, fp, out_vec);
+      output_u32(0, fp, out_vec); // padding
+      write_bm_select_lt(hot_child_bm, hot_node_count, tp.hot_select_lt_sz);
+      write_bm_rank_lt(hot_child_bm, hot_node_count, tp.hot_rank_lt_sz);
+      write_bm_select_lt(cold_child_bm, hot_node_count, tp.cold_select_lt_sz);
+      write_bm_rank_lt(cold_child_bm, hot_node_count, tp.hot_rank_lt_sz);
+      output_bytes((const uint8_t *) hot_child_bm.data(), bm_sz, fp, out_vec);
+      output_bytes((const uint8_t *) cold_child_bm.data(), bm_sz, fp, out_vec);
+    }
+
     void write_fwd_cache() {
       output_bytes((const uint8_t *) f_cache, tp.fwd_cache_count * sizeof(fwd_cache), fp, out_vec);
     }
@@ -3831,7 +4778,11 @@ class builder : public builder_fwd {
         n.set_flags(NFLAG_LEAF | NFLAG_TERM);
         nsh.hdr()->node_id = cur_seq_idx;
         memtrie.node_count++;
+      } else if (ext_sort != NULL) {
+        ext_sort->add(key_rec.data(), key_rec.size(), rec.data(), rec.size());
       } else {
+        if (sorted_maker != NULL)
+          return false;
         leopard::node n;
         leopard::node_set_vars nsv;
         bool exists = memtrie.lookup(key_rec.data(), key_rec.size(), nsv);
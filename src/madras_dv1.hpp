@@ -45,10 +45,28 @@
 
 namespace madras_dv1 {
 
-#define TF_PTR 0
-#define TF_TERM 1
-#define TF_CHILD 2
-#define TF_LEAF 3
+#define MDX_LEAP_NONE 0
+#define MDX_LEAP_ASC 1
+#define MDX_LEAP_RND 2
+#define MDX_LEAP_ANY 3
+
+#define VAL_MAP_NONE 0
+#define VAL_MAP_LOADING 1
+#define VAL_MAP_READY 2
+
+// Section policies for map_file_to_mem(), combined as flags
+#define MDX_MAP_NONE 0
+#define MDX_MAP_WILLNEED 1 // prefetch caches, rank/select lts and trie_flags
+#define MDX_MAP_MLOCK 2 // keep them resident
+#define MDX_MAP_RANDOM_VALS 4 // no readahead for column values
+#define MDX_MAP_HUGEPAGE 8 // transparent hugepages for the mapped trie core
+#define MDX_MAP_HUGEPAGE_COPY 16 // copy trie core to anonymous hugepages
+
+#define MDX_HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+#ifndef MDX_LOOKUP_BATCH_SIZE
+#define MDX_LOOKUP_BATCH_SIZE 16
+#endif
 
 class iter_ctx {
   private:
@@ -156,6 +174,19 @@ class cmn {
       // return ret;
       // #endif
     }
+    // Reads a section location given its version 1 header offset
+    __fq1 __fq2 static uint64_t read_hdr_loc(uint8_t *trie_bytes, int v1_offset) {
+      if (trie_bytes[1] < 2)
+        return read_uint32(trie_bytes + v1_offset);
+      int loc_idx = (v1_offset < 64 ? (v1_offset == 20 ? MDX_HDR_OPTS : (v1_offset - 8) / 4) :
+                      MDX_HDR_FWD_CACHE + (v1_offset - 64) / 4);
+      return read_uint64(trie_bytes + MDX_HDR_V1_SIZE + loc_idx * 8);
+    }
+    __fq1 __fq2 static void prefetch(const void *ptr) {
+      #ifndef __CUDA_ARCH__
+      __builtin_prefetch(ptr, 0, 3);
+      #endif
+    }
     __fq1 __fq2 static int memcmp(const void *ptr1, const void *ptr2, size_t num) {
       #ifndef __CUDA_ARCH__
       return std::memcmp(ptr1, ptr2, num);
@@ -534,6 +565,7 @@ class bvlt_rank {
   protected:
     uint64_t *bm_loc;
     uint8_t *lt_rank_loc;
+    uint32_t *inline_rank_loc;
     uint8_t multiplier;
     uint8_t lt_width;
   public:
@@ -544,6 +576,11 @@ class bvlt_rank {
       return ((bm_loc[pos / 64] >> (pos % 64)) & 1) != 0;
     }
     __fq1 __fq2 uint32_t rank1(uint32_t bv_pos) {
+      if (inline_rank_loc != nullptr) {
+        size_t bm_idx = (bv_pos / nodes_per_bv_block_n) * multiplier;
+        uint64_t mask = (bm_init_mask << (bv_pos % nodes_per_bv_block_n)) - 1;
+        return inline_rank_loc[bm_idx * 2] + static_cast<uint32_t>(__builtin_popcountll(bm_loc[bm_idx] & mask));
+      }
       uint8_t *rank_ptr = lt_rank_loc + bv_pos / nodes_per_bv_block * lt_width;
       uint32_t rank = cmn::read_uint32(rank_ptr);
       #if nodes_per_bv_block == 512
@@ -564,6 +601,12 @@ class bvlt_rank {
       // return rank + __popcountdi2(bm & (mask - 1));
       return rank + static_cast<uint32_t>(__builtin_popcountll(bm & mask));
     }
+    __fq1 __fq2 void prefetch_rank1(uint32_t bv_pos) {
+      if (inline_rank_loc != nullptr)
+        cmn::prefetch(bm_loc + (bv_pos / nodes_per_bv_block_n) * multiplier);
+      else
+        cmn::prefetch(lt_rank_loc + bv_pos / nodes_per_bv_block * lt_width);
+    }
     __fq1 __fq2 uint8_t *get_rank_loc() {
       return lt_rank_loc;
     }
@@ -574,6 +617,12 @@ class bvlt_rank {
       bm_loc = _bm_loc;
       multiplier = _multiplier;
       lt_width = _lt_unit_count * width_of_bv_block;
+      inline_rank_loc = nullptr;
+    }
+    // Uses the counters stored with each block of trie_flags (bldr_options::inline_rank)
+    // instead of lt_rank_loc for rank1(). Selects still go through lt_rank_loc.
+    __fq1 __fq2 void set_inline_rank(uint64_t *tf_loc, int tf_idx) {
+      inline_rank_loc = (uint32_t *) (tf_loc + 4) + tf_idx;
     }
 };
 
@@ -666,6 +715,10 @@ class tail_ptr_map {
     }
     __fq1 __fq2 virtual bool compare_tail(uint32_t node_id, input_ctx& in_ctx, uint32_t& ptr_bit_count) = 0;
     __fq1 __fq2 virtual void get_tail_str(uint32_t node_id, gen::byte_str& tail_str) = 0;
+    template <bool has_inner_tries>
+    __fq1 __fq2 bool compare_tail_t(uint32_t node_id, input_ctx& in_ctx, uint32_t& ptr_bit_count) {
+      return compare_tail(node_id, in_ctx, ptr_bit_count);
+    }
     __fq1 __fq2 static uint32_t read_len(uint8_t *t) {
       while (*t > 15 && *t < 32)
         t++;
@@ -720,7 +773,7 @@ class tail_ptr_map {
         uint8_t sfx_buf[sfx_len];
         #endif
         read_suffix(sfx_buf, data + tail_ptr - 1, sfx_len);
-        if (cmn::memcmp(sfx_buf, in_ctx.key + in_ctx.key_pos, sfx_len) == 0) {
+        if (in_ctx.key_pos + sfx_len <= in_ctx.key_len && cmn::memcmp(sfx_buf, in_ctx.key + in_ctx.key_pos, sfx_len) == 0) {
           in_ctx.key_pos += sfx_len;
           #if defined(__CUDA_ARCH__) || defined(__EMSCRIPTEN__)
           delete [] sfx_buf;
@@ -785,7 +838,7 @@ class ptr_group_map {
     int8_t grp_idx_limit;
     uint8_t inner_trie_start_grp;
 
-    uint32_t *idx_map_arr = nullptr;
+    uint32_t idx_map_arr[32]; // grp_idx_limit is 5 bits
     uint8_t *idx2_ptrs_map_loc;
     __fq1 __fq2 uint32_t read_ptr_from_idx(uint32_t grp_no, uint32_t ptr) {
       return cmn::read_uint24(idx2_ptrs_map_loc + idx_map_arr[grp_no] + ptr * 3);
@@ -824,8 +877,6 @@ class ptr_group_map {
         }
         delete [] inner_tries;
       }
-      if (idx_map_arr != nullptr)
-        delete [] idx_map_arr;
     }
 
     __fq1 __fq2 void init_ptr_grp_map(inner_trie_fwd *_dict_obj, uint8_t *_trie_loc, uint64_t *_bm_loc, uint8_t _multiplier, uint64_t *_tf_ptr_loc,
@@ -867,8 +918,6 @@ class ptr_group_map {
         uint8_t *grp_data_idx_start = code_lt_bit_len + (data_type == 'w' ? 0 : 512);
         grp_data = new uint8_t*[group_count]();
         inner_tries = new inner_trie_fwd*[group_count]();
-        if (data_type == 'w') // todo: fix
-          inner_tries = new inner_trie_fwd*[group_count]();
         for (int i = 0; i < group_count; i++) {
           grp_data[i] = (data_type == 'w' ? grp_data_loc : data_loc);
           grp_data[i] += cmn::read_uint32(grp_data_idx_start + i * 4);
@@ -879,7 +928,7 @@ class ptr_group_map {
             inner_tries[i] = dict_obj->new_instance(grp_data[i]);
         }
         int _start_bits = start_bits;
-        idx_map_arr = new uint32_t[grp_idx_limit + 1]();
+        idx_map_arr[0] = 0;
         for (int i = 1; i <= grp_idx_limit; i++) {
           idx_map_arr[i] = idx_map_arr[i - 1] + (1 << _start_bits) * 3;
           _start_bits += idx_step_bits;
@@ -933,13 +982,24 @@ class tail_ptr_group_map : public tail_ptr_map, public ptr_group_map{
       return ptr;
     }
     __fq1 __fq2 bool compare_tail(uint32_t node_id, input_ctx& in_ctx, uint32_t& ptr_bit_count) {
+      return compare_tail_t<true>(node_id, in_ctx, ptr_bit_count);
+    }
+    template <bool has_inner_tries>
+    __fq1 __fq2 bool compare_tail_t(uint32_t node_id, input_ctx& in_ctx, uint32_t& ptr_bit_count) {
       uint8_t grp_no;
       uint32_t tail_ptr = get_tail_ptr(node_id, ptr_bit_count, grp_no);
       uint8_t *tail = grp_data[grp_no];
-      if (*tail != 0)
+      if (has_inner_tries && *tail != 0)
         return inner_tries[grp_no]->compare_trie_tail(tail_ptr, in_ctx);
       return compare_tail_data(tail, tail_ptr, in_ctx);
     }
+    __fq1 __fq2 bool has_inner_tries() {
+      for (int i = 0; i < group_count; i++) {
+        if (*(grp_data[i]) != 0)
+          return true;
+      }
+      return false;
+    }
     __fq1 __fq2 void get_tail_str(uint32_t node_id, gen::byte_str& tail_str) {
       //ptr_bit_count = UINT32_MAX;
       uint8_t grp_no;
@@ -999,11 +1059,20 @@ class tail_ptr_flat_map : public tail_ptr_map {
       return (int_ptr_bv[ptr_bit_count++] << 8) | trie_loc[node_id];
     }
     __fq1 __fq2 bool compare_tail(uint32_t node_id, input_ctx& in_ctx, uint32_t& ptr_bit_count) {
-      uint32_t tail_ptr = get_tail_ptr(node_id, ptr_bit_count);
       if (inner_trie != nullptr)
+        return compare_tail_t<true>(node_id, in_ctx, ptr_bit_count);
+      return compare_tail_t<false>(node_id, in_ctx, ptr_bit_count);
+    }
+    template <bool has_inner_tries>
+    __fq1 __fq2 bool compare_tail_t(uint32_t node_id, input_ctx& in_ctx, uint32_t& ptr_bit_count) {
+      uint32_t tail_ptr = get_tail_ptr(node_id, ptr_bit_count);
+      if (has_inner_tries)
         return inner_trie->compare_trie_tail(tail_ptr, in_ctx);
       return compare_tail_data(data, tail_ptr, in_ctx);
     }
+    __fq1 __fq2 bool has_inner_tries() {
+      return inner_trie != nullptr;
+    }
     __fq1 __fq2 void get_tail_str(uint32_t node_id, gen::byte_str& tail_str) {
       uint32_t tail_ptr = UINT32_MAX;
       tail_ptr = get_tail_ptr(node_id, tail_ptr); // avoid a stack entry
@@ -1066,6 +1135,26 @@ class GCFC_rev_cache {
     }
 };
 
+#define MDX_SEL_IDX_SUB 8
+#define MDX_SEL_IDX_SUB_COUNT 30
+#define MDX_SEL_IDX_ONES (MDX_SEL_IDX_SUB * (MDX_SEL_IDX_SUB_COUNT + 1))
+// Longest span in bits that select1_from_index scans from a sample
+#define MDX_SEL_IDX_MAX_SPAN 512
+
+#define SEL_IDX_NONE 0
+#define SEL_IDX_LOADING 1
+#define SEL_IDX_READY 2
+#define SEL_IDX_READY_SPARSE 3
+
+// Position of every MDX_SEL_IDX_ONES'th one and u16 offsets from it
+// to every MDX_SEL_IDX_SUB'th one after it, in one cache line.
+// Offsets of UINT16_MAX mean the span to the next sample is longer
+// than MDX_SEL_IDX_MAX_SPAN and select1 falls back to the lookup tables.
+struct sel_index_entry {
+  uint32_t base;
+  uint16_t offsets[MDX_SEL_IDX_SUB_COUNT];
+};
+
 class bvlt_select : public bvlt_rank {
   private:
     __fq1 __fq2 bvlt_select(bvlt_select const&);
@@ -1073,7 +1162,116 @@ class bvlt_select : public bvlt_rank {
   protected:
     uint8_t *lt_sel_loc1;
     uint32_t bv_bit_count;
+    uint32_t one_count;
+    sel_index_entry *sel_index;
+    uint8_t *sel_index_state;
+    uint8_t *sel_index_alloc;
+    // Fills one entry using the lookup tables
+    __fq1 __fq2 void fill_select_entry(size_t entry_idx, sel_index_entry *entry, uint8_t *state) {
+      uint32_t one_idx = entry_idx * MDX_SEL_IDX_ONES;
+      // select1_lt returns the position + 1
+      uint32_t bv_pos = select1_lt(one_idx + 1) - 1;
+      entry->base = bv_pos;
+      uint8_t new_state = SEL_IDX_READY;
+      for (size_t sub_idx = 0; sub_idx <= MDX_SEL_IDX_SUB_COUNT; sub_idx++) {
+        uint32_t next_idx = one_idx + MDX_SEL_IDX_SUB;
+        uint32_t next_pos = next_idx < one_count ? select1_lt(next_idx + 1) - 1 : bv_bit_count;
+        bool is_sparse = (next_pos - bv_pos > MDX_SEL_IDX_MAX_SPAN);
+        if (sub_idx == 0) {
+          if (is_sparse)
+            new_state = SEL_IDX_READY_SPARSE;
+        } else {
+          uint32_t offset = bv_pos - entry->base;
+          entry->offsets[sub_idx - 1] = (is_sparse || offset >= UINT16_MAX || one_idx >= one_count) ? UINT16_MAX : offset;
+        }
+        one_idx = next_idx;
+        bv_pos = next_pos;
+      }
+      #ifdef __CUDA_ARCH__
+      *state = new_state;
+      #else
+      __atomic_store_n(state, new_state, __ATOMIC_RELEASE);
+      #endif
+    }
   public:
+    // Sets up the sampled select index over the bitvector so that
+    // select1 needs one index entry and a few bitmap words.
+    // Entries are filled on first use, so load time stays O(1).
+    __fq1 __fq2 void init_select_index() {
+      release_select_index();
+      if (bv_bit_count == 0)
+        return;
+      uint32_t last_pos = bv_bit_count - 1;
+      one_count = rank1(last_pos) + ((bm_loc[(last_pos / nodes_per_bv_block_n) * multiplier] >> (last_pos % nodes_per_bv_block_n)) & 1);
+      if (one_count == 0)
+        return;
+      size_t entry_count = (one_count - 1) / MDX_SEL_IDX_ONES + 1;
+      sel_index_alloc = new uint8_t[entry_count * sizeof(sel_index_entry) + entry_count + 63];
+      sel_index = (sel_index_entry *) (sel_index_alloc + ((64 - ((uintptr_t) sel_index_alloc % 64)) % 64));
+      sel_index_state = (uint8_t *) (sel_index + entry_count);
+      memset(sel_index_state, SEL_IDX_NONE, entry_count);
+    }
+    __fq1 __fq2 void release_select_index() {
+      if (sel_index_alloc != nullptr)
+        delete [] sel_index_alloc;
+      sel_index_alloc = nullptr;
+      sel_index = nullptr;
+      sel_index_state = nullptr;
+    }
+    // Returns UINT32_MAX if the entry is not filled yet or is sparse
+    __fq1 __fq2 uint32_t select1_from_index(uint32_t target_count) {
+      uint32_t one_idx = target_count - 1;
+      size_t entry_idx = one_idx / MDX_SEL_IDX_ONES;
+      sel_index_entry *entry = sel_index + entry_idx;
+      uint8_t *state_loc = sel_index_state + entry_idx;
+      #ifdef __CUDA_ARCH__
+      uint8_t state = *state_loc;
+      if (state == SEL_IDX_NONE) {
+        fill_select_entry(entry_idx, entry, state_loc);
+        state = *state_loc;
+      }
+      #else
+      uint8_t state = __atomic_load_n(state_loc, __ATOMIC_ACQUIRE);
+      if (state == SEL_IDX_NONE) {
+        uint8_t expected = SEL_IDX_NONE;
+        if (!__atomic_compare_exchange_n(state_loc, &expected, SEL_IDX_LOADING, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+          return UINT32_MAX; // another thread is filling this entry
+        fill_select_entry(entry_idx, entry, state_loc);
+        state = __atomic_load_n(state_loc, __ATOMIC_ACQUIRE);
+      }
+      #endif
+      if (state == SEL_IDX_LOADING)
+        return UINT32_MAX;
+      uint32_t sub_idx = (one_idx % MDX_SEL_IDX_ONES) / MDX_SEL_IDX_SUB;
+      uint32_t bv_pos = entry->base;
+      if (sub_idx > 0) {
+        uint16_t offset = entry->offsets[sub_idx - 1];
+        if (offset == UINT16_MAX)
+          return UINT32_MAX;
+        bv_pos += offset;
+      } else if (state == SEL_IDX_READY_SPARSE)
+        return UINT32_MAX;
+      uint32_t remaining = one_idx % MDX_SEL_IDX_SUB + 1;
+      size_t word_idx = bv_pos / nodes_per_bv_block_n;
+      uint64_t bm = bm_loc[word_idx * multiplier] & (UINT64_MAX << (bv_pos % nodes_per_bv_block_n));
+      uint32_t word_count = __builtin_popcountll(bm);
+      while (word_count < remaining) {
+        remaining -= word_count;
+        word_idx++;
+        bm = bm_loc[word_idx * multiplier];
+        word_count = __builtin_popcountll(bm);
+      }
+      return word_idx * nodes_per_bv_block_n + bm_select1(remaining, bm);
+    }
+    __fq1 __fq2 void prefetch_select1(uint32_t target_count) {
+      if (target_count == 0)
+        return;
+      if (sel_index != nullptr) {
+        size_t entry_idx = (target_count - 1) / MDX_SEL_IDX_ONES;
+        cmn::prefetch(sel_index + entry_idx);
+      } else
+        cmn::prefetch(lt_sel_loc1 + target_count / sel_divisor * 3);
+    }
     __fq1 __fq2 uint32_t bin_srch_lkup_tbl(uint32_t first, uint32_t last, uint32_t given_count) {
       while (first + 1 < last) {
         const uint32_t middle = (first + last) >> 1;
@@ -1087,6 +1285,14 @@ class bvlt_select : public bvlt_rank {
     __fq1 __fq2 uint32_t select1(uint32_t target_count) {
       if (target_count == 0)
         return 0;
+      if (sel_index != nullptr) {
+        uint32_t bv_pos = select1_from_index(target_count);
+        if (bv_pos != UINT32_MAX)
+          return bv_pos;
+      }
+      return select1_lt(target_count);
+    }
+    __fq1 __fq2 uint32_t select1_lt(uint32_t target_count) {
       uint8_t *select_loc = lt_sel_loc1 + target_count / sel_divisor * 3;
       uint32_t block = cmn::read_uint24(select_loc);
       // uint32_t end_block = cmn::read_uint24(select_loc + 3);
@@ -1180,6 +1386,13 @@ class bvlt_select : public bvlt_rank {
       return lt_sel_loc1;
     }
     __fq1 __fq2 bvlt_select() {
+      one_count = 0;
+      sel_index = nullptr;
+      sel_index_state = nullptr;
+      sel_index_alloc = nullptr;
+    }
+    __fq1 __fq2 ~bvlt_select() {
+      release_select_index();
     }
     __fq1 __fq2 void init(uint8_t *_lt_rank_loc, uint8_t *_lt_sel_loc1, uint32_t _bv_bit_count, uint64_t *_bm_loc, uint8_t _multiplier, uint8_t _lt_width) {
       bvlt_rank::init(_lt_rank_loc, _bm_loc, _multiplier, _lt_width);
@@ -1204,6 +1417,8 @@ class inner_trie : public inner_trie_fwd {
     uint32_t node_count;
     
     uint8_t lt_not_given;
+    uint8_t tf_multiplier;
+    bool is_tail_flat;
     uint8_t *trie_loc;
     tail_ptr_map *tail_map;
     bvlt_select child_lt;
@@ -1258,27 +1473,30 @@ class inner_trie : public inner_trie_fwd {
       if (key_count > 0) {
         uint32_t rev_cache_count = cmn::read_uint32(trie_bytes + 48);
         uint32_t rev_cache_max_node_id = cmn::read_uint32(trie_bytes + 56);
-        uint8_t *rev_cache_loc = trie_bytes + cmn::read_uint32(trie_bytes + 68);
+        uint8_t *rev_cache_loc = trie_bytes + cmn::read_hdr_loc(trie_bytes, 68);
         rev_cache.init(rev_cache_loc, rev_cache_count, rev_cache_max_node_id);
 
-        uint8_t *term_select_lkup_loc = trie_bytes + cmn::read_uint32(trie_bytes + 76);
-        uint8_t *term_lt_loc = trie_bytes + cmn::read_uint32(trie_bytes + 80);
-        uint8_t *child_select_lkup_loc = trie_bytes + cmn::read_uint32(trie_bytes + 84);
-        uint8_t *child_lt_loc = trie_bytes + cmn::read_uint32(trie_bytes + 88);
+        uint8_t *term_select_lkup_loc = trie_bytes + cmn::read_hdr_loc(trie_bytes, 76);
+        uint8_t *term_lt_loc = trie_bytes + cmn::read_hdr_loc(trie_bytes, 80);
+        uint8_t *child_select_lkup_loc = trie_bytes + cmn::read_hdr_loc(trie_bytes, 84);
+        uint8_t *child_lt_loc = trie_bytes + cmn::read_hdr_loc(trie_bytes, 88);
 
-        uint8_t *tail_lt_loc = trie_bytes + cmn::read_uint32(trie_bytes + 100);
-        uint8_t *trie_tail_ptrs_data_loc = trie_bytes + cmn::read_uint32(trie_bytes + 104);
+        uint8_t *tail_lt_loc = trie_bytes + cmn::read_hdr_loc(trie_bytes, 100);
+        uint8_t *trie_tail_ptrs_data_loc = trie_bytes + cmn::read_hdr_loc(trie_bytes, 104);
 
         uint32_t tail_size = cmn::read_uint32(trie_tail_ptrs_data_loc);
         //uint32_t trie_flags_size = cmn::read_uint32(trie_tail_ptrs_data_loc + 4);
         uint8_t *tails_loc = trie_tail_ptrs_data_loc + 8;
         trie_loc = tails_loc + tail_size;
 
-        uint64_t *tf_loc = (uint64_t *) (trie_bytes + cmn::read_uint32(trie_bytes + 116));
-        uint64_t *tf_ptr_loc = (uint64_t *) (trie_bytes + cmn::read_uint32(trie_bytes + 120));
+        uint64_t *tf_loc = (uint64_t *) (trie_bytes + cmn::read_hdr_loc(trie_bytes, 116));
+        uint64_t *tf_ptr_loc = (uint64_t *) (trie_bytes + cmn::read_hdr_loc(trie_bytes, 120));
 
-        bldr_options *opts = (bldr_options *) (trie_bytes + cmn::read_uint32(trie_bytes + 20));
+        bldr_options *opts = (bldr_options *) (trie_bytes + cmn::read_hdr_loc(trie_bytes, 20));
         uint8_t multiplier = opts->trie_leaf_count > 0 ? 4 : 3;
+        if (opts->inline_rank)
+          multiplier = 8;
+        tf_multiplier = opts->inline_rank ? 8 : 4;
 
         uint8_t encoding_type = tails_loc[2];
         uint8_t *tail_data_loc = tails_loc + cmn::read_uint32(tails_loc + 12);
@@ -1286,10 +1504,12 @@ class inner_trie : public inner_trie_fwd {
           tail_ptr_flat_map *tail_flat_map = new tail_ptr_flat_map();  // Release where?
           tail_flat_map->init(this, &tail_lt, trie_loc, tails_loc);
           tail_map = tail_flat_map;
+          is_tail_flat = true;
         } else {
           tail_ptr_group_map *tail_grp_map = new tail_ptr_group_map();
           tail_grp_map->init_ptr_grp_map(this, trie_loc, tf_loc, trie_level == 0 ? multiplier : 1, trie_level == 0 ? tf_loc : tf_ptr_loc, tails_loc, key_count, node_count, true);
           tail_map = tail_grp_map;
+          is_tail_flat = false;
         }
 
         lt_not_given = 0;
@@ -1313,10 +1533,17 @@ class inner_trie : public inner_trie_fwd {
         if (trie_level == 0) {
           term_lt.init(term_lt_loc, term_select_lkup_loc, node_count, tf_loc + TF_TERM, multiplier, bvlt_block_count);
           child_lt.init(child_lt_loc, child_select_lkup_loc, node_count, tf_loc + TF_CHILD, multiplier, bvlt_block_count);
+          term_lt.init_select_index();
         } else {
           child_lt.init(child_lt_loc, child_select_lkup_loc, node_count * 2, tf_loc, 1, 1);
         }
+        child_lt.init_select_index();
         tail_lt.init(tail_lt_loc, trie_level == 0 ? tf_loc + TF_PTR : tf_ptr_loc, trie_level == 0 ? multiplier : 1, trie_level == 0 ? 3 : 1);
+        if (trie_level == 0 && opts->inline_rank) {
+          term_lt.set_inline_rank(tf_loc, TF_TERM);
+          child_lt.set_inline_rank(tf_loc, TF_CHILD);
+          tail_lt.set_inline_rank(tf_loc, TF_PTR);
+        }
       }
 
     }
@@ -1368,6 +1595,12 @@ class GCFC_fwd_cache {
       } while (1);
       return -1;
     }
+    __fq1 __fq2 void prefetch(input_ctx& in_ctx) {
+      if (in_ctx.node_id >= max_node_id)
+        return;
+      uint32_t cache_idx = (in_ctx.node_id ^ (in_ctx.node_id << MDX_CACHE_SHIFT) ^ in_ctx.key[in_ctx.key_pos]) & cache_mask;
+      cmn::prefetch(cche0 + cache_idx);
+    }
     __fq1 __fq2 GCFC_fwd_cache() {
     }
     __fq1 __fq2 void init(uint8_t *_loc, uint32_t _count, uint32_t _max_node_id) {
@@ -1377,77 +1610,579 @@ class GCFC_fwd_cache {
     }
 };
 
+#ifndef MDX_OVERLAY_SHARDS
+#define MDX_OVERLAY_SHARDS 16 // hit/miss counter lines, threads map to them round robin
+#endif
+#define MDX_OVERLAY_AGE_CHUNK 64 // sketch bytes halved per admit() while aging
+
+struct overlay_counters {
+  uint64_t hit_count;
+  uint64_t miss_count;
+  uint8_t pad[48];
+};
+
+// Runtime overlay for GCFC_fwd_cache, learnt from the queries seen.
+// Direct mapped, each entry packs parent node id (24 bits), node byte,
+// child node id (24 bits) and the offset of the matched node in the set.
+// Entries are admitted on misses by TinyLFU, that is when the candidate
+// is estimated to be more frequent than the entry it replaces.
+// Lock-free, so that one instance can be shared by all threads using the trie.
+// Sketch counts use relaxed atomics, concurrent increments and aging may drop
+// a count. Aging is spread over the following admit() calls, a chunk at a time.
+class fwd_cache_overlay {
+  private:
+    __fq1 __fq2 fwd_cache_overlay(fwd_cache_overlay const&);
+    __fq1 __fq2 fwd_cache_overlay& operator=(fwd_cache_overlay const&);
+    uint64_t *entries;
+    uint8_t *freq_sketch;
+    uint32_t entry_mask;
+    uint32_t sketch_mask;
+    uint32_t sample_count;
+    uint32_t sample_size;
+    uint32_t age_cursor; // next sketch byte to halve, > sketch_mask when not aging
+    overlay_counters counters[MDX_OVERLAY_SHARDS];
+    __fq1 __fq2 static uint32_t hash_key(uint32_t parent_node_id, uint8_t key_byte) {
+      uint32_t h = (parent_node_id << 8 | key_byte) * 0x9E3779B1U;
+      return h ^ (h >> 16);
+    }
+    __fq1 __fq2 static uint64_t load_u64(uint64_t *loc) {
+      #ifdef __CUDA_ARCH__
+      return *((volatile uint64_t *) loc);
+      #else
+      return __atomic_load_n(loc, __ATOMIC_RELAXED);
+      #endif
+    }
+    __fq1 __fq2 static void add_u64(uint64_t *loc) {
+      #ifdef __CUDA_ARCH__
+      (*loc)++;
+      #else
+      __atomic_fetch_add(loc, 1, __ATOMIC_RELAXED);
+      #endif
+    }
+    __fq1 __fq2 static uint8_t load_u8(uint8_t *loc) {
+      #ifdef __CUDA_ARCH__
+      return *((volatile uint8_t *) loc);
+      #else
+      return __atomic_load_n(loc, __ATOMIC_RELAXED);
+      #endif
+    }
+    __fq1 __fq2 static void store_u8(uint8_t *loc, uint8_t val) {
+      #ifdef __CUDA_ARCH__
+      *((volatile uint8_t *) loc) = val;
+      #else
+      __atomic_store_n(loc, val, __ATOMIC_RELAXED);
+      #endif
+    }
+    // Saturating increment, returns the new count
+    __fq1 __fq2 static uint8_t inc_u8(uint8_t *loc) {
+      #ifdef __CUDA_ARCH__
+      uint8_t count = *((volatile uint8_t *) loc);
+      if (count < UINT8_MAX)
+        *((volatile uint8_t *) loc) = ++count;
+      return count;
+      #else
+      uint8_t count = __atomic_load_n(loc, __ATOMIC_RELAXED);
+      while (count < UINT8_MAX) {
+        if (__atomic_compare_exchange_n(loc, &count, count + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+          return count + 1;
+      }
+      return count;
+      #endif
+    }
+    __fq1 __fq2 overlay_counters *get_counters() {
+      #ifdef __CUDA_ARCH__
+      return counters;
+      #else
+      static uint32_t shard_seq = 0;
+      static thread_local uint32_t shard = UINT32_MAX;
+      if (shard == UINT32_MAX)
+        shard = __atomic_fetch_add(&shard_seq, 1, __ATOMIC_RELAXED) % MDX_OVERLAY_SHARDS;
+      return counters + shard;
+      #endif
+    }
+    __fq1 __fq2 uint8_t estimate(uint32_t h) {
+      uint8_t f1 = load_u8(freq_sketch + (h & sketch_mask));
+      uint8_t f2 = load_u8(freq_sketch + ((h >> 12 ^ h << 7) & sketch_mask));
+      return f1 < f2 ? f1 : f2;
+    }
+    __fq1 __fq2 uint8_t increment(uint32_t h) {
+      uint8_t f1 = inc_u8(freq_sketch + (h & sketch_mask));
+      uint8_t f2 = inc_u8(freq_sketch + ((h >> 12 ^ h << 7) & sketch_mask));
+      #ifdef __CUDA_ARCH__
+      if (++sample_count == sample_size) {
+      #else
+      if (__atomic_add_fetch(&sample_count, 1, __ATOMIC_RELAXED) == sample_size) {
+      #endif
+        // start aging the counts so that the cache follows changes in the query mix
+        #ifdef __CUDA_ARCH__
+        sample_count = 0;
+        age_cursor = 0;
+        #else
+        __atomic_store_n(&sample_count, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&age_cursor, 0, __ATOMIC_RELAXED);
+        #endif
+      }
+      return f1 < f2 ? f1 : f2;
+    }
+    // Halves the next chunk of the sketch if an aging pass is due
+    __fq1 __fq2 void age_chunk() {
+      #ifdef __CUDA_ARCH__
+      uint32_t from = age_cursor;
+      if (from > sketch_mask)
+        return;
+      age_cursor = from + MDX_OVERLAY_AGE_CHUNK;
+      #else
+      if (__atomic_load_n(&age_cursor, __ATOMIC_RELAXED) > sketch_mask)
+        return;
+      uint32_t from = __atomic_fetch_add(&age_cursor, MDX_OVERLAY_AGE_CHUNK, __ATOMIC_RELAXED);
+      if (from > sketch_mask)
+        return;
+      #endif
+      // sketch size is a power of 2 and at least 256, so chunks do not cross its end
+      for (uint32_t i = from; i < from + MDX_OVERLAY_AGE_CHUNK; i++)
+        store_u8(freq_sketch + i, load_u8(freq_sketch + i) >> 1);
+    }
+  public:
+    __fq1 __fq2 fwd_cache_overlay() {
+      entries = nullptr;
+      freq_sketch = nullptr;
+      entry_mask = sketch_mask = 0;
+      sample_count = sample_size = 0;
+      age_cursor = UINT32_MAX;
+      reset_counters();
+    }
+    __fq1 __fq2 ~fwd_cache_overlay() {
+      if (entries != nullptr)
+        delete [] entries;
+      if (freq_sketch != nullptr)
+        delete [] freq_sketch;
+    }
+    // entry_count is rounded up to a power of 2
+    __fq1 __fq2 void init(uint32_t entry_count) {
+      uint32_t count = 64;
+      while (count < entry_count)
+        count <<= 1;
+      if (entries != nullptr)
+        delete [] entries;
+      if (freq_sketch != nullptr)
+        delete [] freq_sketch;
+      entries = new uint64_t[count];
+      memset(entries, 0xFF, count * sizeof(uint64_t));
+      freq_sketch = new uint8_t[count * 4];
+      memset(freq_sketch, '\0', count * 4);
+      entry_mask = count - 1;
+      sketch_mask = count * 4 - 1;
+      sample_count = 0;
+      sample_size = count * 10;
+      age_cursor = UINT32_MAX;
+      reset_counters();
+    }
+    __fq1 __fq2 bool try_find(uint32_t parent_node_id, uint8_t key_byte, uint32_t& node_offset, uint32_t& child_node_id) {
+      if (parent_node_id >= 0xFFFFFF)
+        return false;
+      uint64_t entry = load_u64(entries + (hash_key(parent_node_id, key_byte) & entry_mask));
+      if ((entry & 0xFFFFFFFFULL) == (parent_node_id | ((uint32_t) key_byte << 24))) {
+        child_node_id = (entry >> 32) & 0xFFFFFF;
+        node_offset = entry >> 56;
+        add_u64(&get_counters()->hit_count);
+        return true;
+      }
+      add_u64(&get_counters()->miss_count);
+      return false;
+    }
+    // Called after a miss, returns true if the entry should be stored with put()
+    __fq1 __fq2 bool admit(uint32_t parent_node_id, uint8_t key_byte) {
+      if (parent_node_id >= 0xFFFFFF)
+        return false;
+      age_chunk();
+      uint32_t h = hash_key(parent_node_id, key_byte);
+      uint8_t cand_freq = increment(h);
+      uint64_t entry = load_u64(entries + (h & entry_mask));
+      if (entry == UINT64_MAX)
+        return true;
+      uint32_t victim_h = hash_key(entry & 0xFFFFFF, (entry >> 24) & 0xFF);
+      return cand_freq > estimate(victim_h);
+    }
+    __fq1 __fq2 void put(uint32_t parent_node_id, uint8_t key_byte, uint32_t node_offset, uint32_t child_node_id) {
+      if (node_offset > UINT8_MAX || child_node_id >= 0xFFFFFF)
+        return;
+      uint64_t entry = parent_node_id | ((uint64_t) key_byte << 24) |
+                ((uint64_t) child_node_id << 32) | ((uint64_t) node_offset << 56);
+      uint64_t *loc = entries + (hash_key(parent_node_id, key_byte) & entry_mask);
+      #ifdef __CUDA_ARCH__
+      *((volatile uint64_t *) loc) = entry;
+      #else
+      __atomic_store_n(loc, entry, __ATOMIC_RELAXED);
+      #endif
+    }
+    __fq1 __fq2 uint64_t get_hit_count() {
+      uint64_t count = 0;
+      for (size_t i = 0; i < MDX_OVERLAY_SHARDS; i++)
+        count += load_u64(&counters[i].hit_count);
+      return count;
+    }
+    __fq1 __fq2 uint64_t get_miss_count() {
+      uint64_t count = 0;
+      for (size_t i = 0; i < MDX_OVERLAY_SHARDS; i++)
+        count += load_u64(&counters[i].miss_count);
+      return count;
+    }
+    __fq1 __fq2 void reset_counters() {
+      for (size_t i = 0; i < MDX_OVERLAY_SHARDS; i++) {
+        #ifdef __CUDA_ARCH__
+        counters[i].hit_count = counters[i].miss_count = 0;
+        #else
+        __atomic_store_n(&counters[i].hit_count, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&counters[i].miss_count, 0, __ATOMIC_RELAXED);
+        #endif
+      }
+    }
+};
+
 class static_trie : public inner_trie {
   protected:
     bvlt_select *leaf_lt;
     GCFC_fwd_cache fwd_cache;
+    fwd_cache_overlay *fwd_overlay;
     trie_flags *trie_flags_loc;
     leapfrog *leaper;
     uint16_t max_tail_len;
     uint32_t key_count;
     uint8_t *trie_bytes;
+    bvlt_select hot_child_lt;
+    bvlt_select cold_child_lt;
+    uint32_t hot_ns_count;
+    uint32_t hot_node_count;
+    uint32_t hot_cold_ns_limit;
 
   private:
     __fq1 __fq2 static_trie(static_trie const&);
     __fq1 __fq2 static_trie& operator=(static_trie const&);
     size_t max_key_len;
     uint16_t max_level;
+    bool (static_trie::*lookup_fn)(input_ctx& in_ctx);
+    int (static_trie::*lookup_step_fn)(input_ctx& in_ctx);
+    int (static_trie::*lookup_step_defer_fn)(input_ctx& in_ctx);
   protected:
     bldr_options *opts;
   public:
     __fq1 __fq2 bool lookup(input_ctx& in_ctx) {
+      #ifdef __CUDA_ARCH__
+      return lookup_t<MDX_LEAP_ANY, true, tail_ptr_map, true>(in_ctx);
+      #else
+      return (this->*lookup_fn)(in_ctx);
+      #endif
+    }
+
+    __fq1 __fq2 trie_flags *get_trie_flags(uint32_t node_id) {
+      return (trie_flags *) ((uint64_t *) trie_flags_loc + (node_id / nodes_per_bv_block_n) * tf_multiplier);
+    }
+
+    __fq1 __fq2 trie_flags *next_trie_flags(trie_flags *tf) {
+      return (trie_flags *) ((uint64_t *) tf + tf_multiplier);
+    }
+
+    // Matches one node set and moves in_ctx to the child node set.
+    // Returns -1 to continue, 1 if found and 0 if not found
+    __fq1 __fq2 int lookup_step(input_ctx& in_ctx) {
+      #ifdef __CUDA_ARCH__
+      return lookup_step_t<MDX_LEAP_ANY, true, tail_ptr_map, true>(in_ctx);
+      #else
+      return (this->*lookup_step_fn)(in_ctx);
+      #endif
+    }
+
+    // Same as lookup_step, but returns -2 with in_ctx.node_id left at the
+    // matched parent instead of resolving the child node set
+    __fq1 __fq2 int lookup_step_defer(input_ctx& in_ctx) {
+      #ifdef __CUDA_ARCH__
+      return lookup_step_t<MDX_LEAP_ANY, true, tail_ptr_map, true, true>(in_ctx);
+      #else
+      return (this->*lookup_step_defer_fn)(in_ctx);
+      #endif
+    }
+
+    template <int leap_type, bool use_fwd_cache, class tail_map_t, bool has_inner_tries>
+    __fq1 __fq2 bool lookup_t(input_ctx& in_ctx) {
       in_ctx.key_pos = 0;
       in_ctx.node_id = 1;
+      int ret;
+      do {
+        ret = lookup_step_t<leap_type, use_fwd_cache, tail_map_t, has_inner_tries>(in_ctx);
+      } while (ret < 0);
+      return ret == 1;
+    }
+
+    #if defined(__AVX2__) && !defined(__CUDA_ARCH__)
+    // Bit i set if loc[i] == key_byte, for the 64 bytes at loc
+    __fq1 __fq2 static uint64_t cmpeq_mask64(const uint8_t *loc, uint8_t key_byte) {
+      #if defined(__AVX512BW__)
+      return _mm512_cmpeq_epi8_mask(_mm512_loadu_si512((const void *) loc), _mm512_set1_epi8(key_byte));
+      #else
+      __m256i to_locate = _mm256_set1_epi8(key_byte);
+      uint32_t lo = _mm256_movemask_epi8(_mm256_cmpeq_epi8(to_locate, _mm256_loadu_si256((const __m256i *) loc)));
+      uint32_t hi = _mm256_movemask_epi8(_mm256_cmpeq_epi8(to_locate, _mm256_loadu_si256((const __m256i *) (loc + 32))));
+      return ((uint64_t) hi << 32) | lo;
+      #endif
+    }
+
+    // Jumps to the next node from node_id in this word that matches the key byte
+    // or has a tail. Returns 1 at that node (or when the word is the last and
+    // partial, to be scanned byte by byte), 0 if the node set ends before one
+    // and -1 with node_id at the next word if this word has none.
+    __fq1 __fq2 int scan_siblings(input_ctx& in_ctx, trie_flags *&tf, uint64_t& bm_mask) {
+      if ((in_ctx.node_id | (nodes_per_bv_block_n - 1)) >= node_count)
+        return 1;
+      uint32_t bit_pos = in_ctx.node_id % nodes_per_bv_block_n;
+      uint64_t from_mask = ~(bm_mask - 1);
+      uint64_t term_bits = tf->bm_term & from_mask;
+      uint64_t set_mask = term_bits ? from_mask & (((term_bits & (0 - term_bits)) << 1) - 1) : from_mask;
+      uint64_t candidates = (cmpeq_mask64(trie_loc + in_ctx.node_id - bit_pos, in_ctx.key[in_ctx.key_pos]) | tf->bm_ptr) & set_mask;
+      if (candidates == 0) {
+        if (term_bits)
+          return 0;
+        in_ctx.node_id += (nodes_per_bv_block_n - bit_pos);
+        bm_mask = bm_init_mask;
+        tf = next_trie_flags(tf);
+        return -1;
+      }
+      int match_pos = __builtin_ctzll(candidates);
+      in_ctx.node_id += (match_pos - bit_pos);
+      bm_mask = bm_init_mask << match_pos;
+      return 1;
+    }
+    #endif
+
+    template <int leap_type, bool use_fwd_cache, class tail_map_t, bool has_inner_tries, bool defer_child = false>
+    __fq1 __fq2 int lookup_step_t(input_ctx& in_ctx) {
       trie_flags *tf;
       uint64_t bm_mask;
-      do {
-        int ret = fwd_cache.try_find(in_ctx);
-        bm_mask = bm_init_mask << (in_ctx.node_id % nodes_per_bv_block_n);
-        tf = trie_flags_loc + in_ctx.node_id / nodes_per_bv_block_n;
-        if (ret == 0)
-          return bm_mask & tf->bm_leaf;
-        if (leaper != nullptr) {
-          if ((bm_mask & tf->bm_leaf) == 0 && (bm_mask & tf->bm_child) == 0) {
-            leaper->find_pos(in_ctx.node_id, trie_loc, in_ctx.key[in_ctx.key_pos]);
-            bm_mask = bm_init_mask << (in_ctx.node_id % nodes_per_bv_block_n);
-            tf = trie_flags_loc + in_ctx.node_id / nodes_per_bv_block_n;
+      int ret = use_fwd_cache ? fwd_cache.try_find(in_ctx) : -1;
+      uint32_t ns_node_id = in_ctx.node_id;
+      if (ret != 0 && fwd_overlay != nullptr) {
+        uint32_t node_offset, child_node_id;
+        if (fwd_overlay->try_find(ns_node_id, in_ctx.key[in_ctx.key_pos], node_offset, child_node_id)) {
+          in_ctx.node_id += node_offset;
+          if (++in_ctx.key_pos < in_ctx.key_len) {
+            if (child_node_id == 0)
+              return 0;
+            in_ctx.node_id = child_node_id;
+            return -1;
           }
+          ret = 0;
         }
-        uint32_t ptr_bit_count = UINT32_MAX;
-        do {
-          if ((bm_mask & tf->bm_ptr) == 0) {
-            if (in_ctx.key[in_ctx.key_pos] == trie_loc[in_ctx.node_id]) {
-              in_ctx.key_pos++;
-              break;
-            }
-            #ifdef MDX_IN_ORDER
-              if (in_ctx.key[in_ctx.key_pos] < trie_loc[in_ctx.node_id])
-                return false;
-            #endif
-          } else {
-            uint32_t prev_key_pos = in_ctx.key_pos;
-            if (tail_map->compare_tail(in_ctx.node_id, in_ctx, ptr_bit_count))
-              break;
-            if (prev_key_pos != in_ctx.key_pos)
-              return false;
-            }
-          if (bm_mask & tf->bm_term)
-            return false;
-          in_ctx.node_id++;
-          bm_mask <<= 1;
-          if (bm_mask == 0) {
-            bm_mask = bm_init_mask;
-            tf++;
+      }
+      bm_mask = bm_init_mask << (in_ctx.node_id % nodes_per_bv_block_n);
+      tf = get_trie_flags(in_ctx.node_id);
+      if (ret == 0)
+        return (bm_mask & tf->bm_leaf) ? 1 : 0;
+      if (leap_type != MDX_LEAP_NONE && (leap_type != MDX_LEAP_ANY || leaper != nullptr)) {
+        if ((bm_mask & tf->bm_leaf) == 0 && (bm_mask & tf->bm_child) == 0) {
+          if (leap_type == MDX_LEAP_ASC)
+            static_cast<leapfrog_asc *>(leaper)->leapfrog_asc::find_pos(in_ctx.node_id, trie_loc, in_ctx.key[in_ctx.key_pos]);
+          else if (leap_type == MDX_LEAP_RND)
+            static_cast<leapfrog_rnd *>(leaper)->leapfrog_rnd::find_pos(in_ctx.node_id, trie_loc, in_ctx.key[in_ctx.key_pos]);
+          else
+            leaper->find_pos(in_ctx.node_id, trie_loc, in_ctx.key[in_ctx.key_pos]);
+          bm_mask = bm_init_mask << (in_ctx.node_id % nodes_per_bv_block_n);
+          tf = get_trie_flags(in_ctx.node_id);
+        }
+      }
+      uint32_t ptr_bit_count = UINT32_MAX;
+      do {
+        #if defined(__AVX2__) && !defined(__CUDA_ARCH__)
+        int scan_ret = scan_siblings(in_ctx, tf, bm_mask);
+        if (scan_ret == 0)
+          return 0;
+        if (scan_ret < 0)
+          continue;
+        #endif
+        if ((bm_mask & tf->bm_ptr) == 0) {
+          if (in_ctx.key[in_ctx.key_pos] == trie_loc[in_ctx.node_id]) {
+            in_ctx.key_pos++;
+            break;
           }
-        } while (1);
-        if (in_ctx.key_pos == in_ctx.key_len) {
-          return 0 != (bm_mask & tf->bm_leaf);
+          #ifdef MDX_IN_ORDER
+            if (in_ctx.key[in_ctx.key_pos] < trie_loc[in_ctx.node_id])
+              return 0;
+          #endif
+        } else {
+          uint32_t prev_key_pos = in_ctx.key_pos;
+          if (static_cast<tail_map_t *>(tail_map)->template compare_tail_t<has_inner_tries>(in_ctx.node_id, in_ctx, ptr_bit_count))
+            break;
+          if (prev_key_pos != in_ctx.key_pos)
+            return 0;
+        }
+        if (bm_mask & tf->bm_term)
+          return 0;
+        in_ctx.node_id++;
+        bm_mask <<= 1;
+        if (bm_mask == 0) {
+          bm_mask = bm_init_mask;
+          tf = next_trie_flags(tf);
         }
-        if ((bm_mask & tf->bm_child) == 0)
-          return false;
-        in_ctx.node_id = term_lt.select1(child_lt.rank1(in_ctx.node_id) + 1);
       } while (1);
-      return false;
+      if (fwd_overlay != nullptr && (bm_mask & tf->bm_ptr) == 0) {
+        uint8_t key_byte = in_ctx.key[in_ctx.key_pos - 1];
+        if (fwd_overlay->admit(ns_node_id, key_byte)) {
+          uint32_t child_node_id = (bm_mask & tf->bm_child) ? get_child_node_id(in_ctx.node_id) : 0;
+          fwd_overlay->put(ns_node_id, key_byte, in_ctx.node_id - ns_node_id, child_node_id);
+          if (in_ctx.key_pos < in_ctx.key_len && child_node_id > 0) {
+            in_ctx.node_id = child_node_id;
+            return -1;
+          }
+        }
+      }
+      if (in_ctx.key_pos == in_ctx.key_len)
+        return (bm_mask & tf->bm_leaf) ? 1 : 0;
+      if ((bm_mask & tf->bm_child) == 0)
+        return 0;
+      if (defer_child)
+        return -2;
+      in_ctx.node_id = get_child_node_id(in_ctx.node_id);
+      return -1;
+    }
+
+    // Sets a caller owned runtime cache consulted after fwd_cache (nullptr to disable).
+    // Its entries hold node ids of this trie, so it cannot be moved to another trie.
+    __fq1 __fq2 void set_fwd_cache_overlay(fwd_cache_overlay *_fwd_overlay) {
+      fwd_overlay = _fwd_overlay;
+    }
+
+    __fq1 __fq2 fwd_cache_overlay *get_fwd_cache_overlay() {
+      return fwd_overlay;
+    }
+
+    template <int leap_type, bool use_fwd_cache, class tail_map_t>
+    __fq1 __fq2 void select_lookup_fn_tm(bool has_inner_tries) {
+      if (has_inner_tries) {
+        lookup_fn = &static_trie::lookup_t<leap_type, use_fwd_cache, tail_map_t, true>;
+        lookup_step_fn = &static_trie::lookup_step_t<leap_type, use_fwd_cache, tail_map_t, true>;
+        lookup_step_defer_fn = &static_trie::lookup_step_t<leap_type, use_fwd_cache, tail_map_t, true, true>;
+      } else {
+        lookup_fn = &static_trie::lookup_t<leap_type, use_fwd_cache, tail_map_t, false>;
+        lookup_step_fn = &static_trie::lookup_step_t<leap_type, use_fwd_cache, tail_map_t, false>;
+        lookup_step_defer_fn = &static_trie::lookup_step_t<leap_type, use_fwd_cache, tail_map_t, false, true>;
+      }
+    }
+
+    template <int leap_type, bool use_fwd_cache>
+    __fq1 __fq2 void select_lookup_fn_fc(bool is_flat_tail, bool has_inner_tries) {
+      if (is_flat_tail)
+        select_lookup_fn_tm<leap_type, use_fwd_cache, tail_ptr_flat_map>(has_inner_tries);
+      else
+        select_lookup_fn_tm<leap_type, use_fwd_cache, tail_ptr_group_map>(has_inner_tries);
+    }
+
+    template <int leap_type>
+    __fq1 __fq2 void select_lookup_fn_lt(bool use_fwd_cache, bool is_flat_tail, bool has_inner_tries) {
+      if (use_fwd_cache)
+        select_lookup_fn_fc<leap_type, true>(is_flat_tail, has_inner_tries);
+      else
+        select_lookup_fn_fc<leap_type, false>(is_flat_tail, has_inner_tries);
+    }
+
+    // Picks the lookup kernel specialised for the options the trie was built with
+    __fq1 __fq2 void select_lookup_fn(bool use_fwd_cache) {
+      bool has_inner_tries = (is_tail_flat ? static_cast<tail_ptr_flat_map *>(tail_map)->has_inner_tries()
+                                  : static_cast<tail_ptr_group_map *>(tail_map)->has_inner_tries());
+      if (leaper == nullptr)
+        select_lookup_fn_lt<MDX_LEAP_NONE>(use_fwd_cache, is_tail_flat, has_inner_tries);
+      else if (opts->sort_nodes_on_freq)
+        select_lookup_fn_lt<MDX_LEAP_RND>(use_fwd_cache, is_tail_flat, has_inner_tries);
+      else
+        select_lookup_fn_lt<MDX_LEAP_ASC>(use_fwd_cache, is_tail_flat, has_inner_tries);
+    }
+
+    // Issues loads for the node set that lookup_step would visit next
+    __fq1 __fq2 void prefetch_node_set(input_ctx& in_ctx) {
+      fwd_cache.prefetch(in_ctx);
+      cmn::prefetch(get_trie_flags(in_ctx.node_id));
+      cmn::prefetch(trie_loc + in_ctx.node_id);
+      child_lt.prefetch_rank1(in_ctx.node_id);
+    }
+
+    // Looks up n keys, keeping MDX_LOOKUP_BATCH_SIZE of them in flight and
+    // switching keys after each dependent load so that the prefetches can land:
+    // a matched node set yields the child node set id (rank) and prefetches its
+    // select entry, then the select resolves the child and prefetches its flags.
+    // cmp is set to 0 for keys found, 1 otherwise. Returns found count.
+    __fq1 __fq2 size_t lookup_batch(input_ctx *ctxs, size_t n) {
+      input_ctx *slots[MDX_LOOKUP_BATCH_SIZE];
+      uint32_t child_ns_ids[MDX_LOOKUP_BATCH_SIZE]; // 0 if no select is pending
+      size_t slot_count = 0;
+      size_t next_idx = 0;
+      size_t found_count = 0;
+      while (slot_count < MDX_LOOKUP_BATCH_SIZE && next_idx < n) {
+        input_ctx *ctx = ctxs + next_idx++;
+        ctx->key_pos = 0;
+        ctx->node_id = 1;
+        child_ns_ids[slot_count] = 0;
+        slots[slot_count++] = ctx;
+      }
+      size_t i = 0;
+      while (slot_count > 0) {
+        if (i >= slot_count)
+          i = 0;
+        input_ctx *ctx = slots[i];
+        if (child_ns_ids[i] > 0) {
+          ctx->node_id = term_lt.select1(child_ns_ids[i]);
+          child_ns_ids[i] = 0;
+          prefetch_node_set(*ctx);
+          i++;
+          continue;
+        }
+        int ret = lookup_step_defer(*ctx);
+        if (ret == -2) {
+          child_ns_ids[i] = get_child_ns_id(ctx->node_id);
+          term_lt.prefetch_select1(child_ns_ids[i]);
+          i++;
+          continue;
+        }
+        if (ret < 0) {
+          prefetch_node_set(*ctx);
+          i++;
+          continue;
+        }
+        ctx->cmp = (ret == 1 ? 0 : 1);
+        found_count += ret;
+        if (next_idx < n) {
+          ctx = ctxs + next_idx++;
+          ctx->key_pos = 0;
+          ctx->node_id = 1;
+          slots[i++] = ctx;
+        } else {
+          slot_count--;
+          slots[i] = slots[slot_count];
+          child_ns_ids[i] = child_ns_ids[slot_count];
+        }
+      }
+      return found_count;
+    }
+
+    // Node sets of the hot region (see bldr_options::hot_region_size) are numbered
+    // ahead of the cold ones, so below hot_node_count the child flags are split
+    // into hot and cold bitvectors to map nodes to child node set ids and back
+    __fq1 __fq2 uint32_t get_child_ns_id(uint32_t node_id) {
+      if (node_id >= hot_node_count)
+        return child_lt.rank1(node_id) + 1;
+      uint32_t hot_rank = hot_child_lt.rank1(node_id);
+      if (hot_child_lt.is_set1(node_id))
+        return hot_rank + 1;
+      return hot_ns_count + child_lt.rank1(node_id) - hot_rank + 1;
+    }
+
+    __fq1 __fq2 uint32_t get_child_node_id(uint32_t node_id) {
+      return term_lt.select1(get_child_ns_id(node_id));
+    }
+
+    __fq1 __fq2 uint32_t get_parent_node_id(uint32_t node_id) {
+      uint32_t ns_id = term_lt.rank1(node_id);
+      if (ns_id > hot_cold_ns_limit)
+        return child_lt.select1(ns_id) - 1;
+      if (ns_id > hot_ns_count)
+        return cold_child_lt.select1(ns_id - hot_ns_count) - 1;
+      return hot_child_lt.select1(ns_id) - 1;
     }
 
     __fq1 __fq2 bool reverse_lookup(uint32_t leaf_id, size_t *in_size_out_key_len, uint8_t *ret_key, bool to_reverse = true) {
@@ -1467,7 +2202,7 @@ class static_trie : public inner_trie {
           tail.append(trie_loc[node_id]);
         }
         if (!rev_cache.try_find(node_id, tail))
-          node_id = child_lt.select1(term_lt.rank1(node_id)) - 1;
+          node_id = get_parent_node_id(node_id);
       } while (node_id != 0);
       if (to_reverse)
         reverse_byte_str(tail.data(), tail.length());
@@ -1593,7 +2328,7 @@ class static_trie : public inner_trie {
           else
             tail.append(trie_loc[node_id]);
           update_ctx(ctx, tail, node_id);
-          node_id = term_lt.select1(child_lt.rank1(node_id) + 1);
+          node_id = get_child_node_id(node_id);
           push_to_ctx(ctx, tail, node_id);
         }
       }
@@ -1654,7 +2389,7 @@ class static_trie : public inner_trie {
         insert_into_ctx(ctx, tail, in_ctx.node_id);
         // printf("[%.*s]\n", (int) tail.length(), tail.data());
         // if (!rev_cache.try_find(in_ctx.node_id, tail))
-          in_ctx.node_id = child_lt.select1(term_lt.rank1(in_ctx.node_id)) - 1;
+          in_ctx.node_id = get_parent_node_id(in_ctx.node_id);
         tail.clear();
       } while (in_ctx.node_id != 0);
       ctx.cur_idx--;
@@ -1672,28 +2407,346 @@ class static_trie : public inner_trie {
       return in_ctx.node_id;
     }
 
-    __fq1 __fq2 bvlt_select *get_leaf_lt() {
-      return leaf_lt;
+    // Scans the node set at in_ctx.node_id for the node whose tail continues the key
+    // at in_ctx.key_pos, as lookup_step_t does but without the caches. Returns 1
+    // with node_id at that node and key_pos after its tail, 0 if no node starts
+    // with the key byte and -1 if a tail does but the rest differs or the key ends
+    // inside it, with node_id at that node and key_pos unchanged. tf and bm_mask
+    // are left at the flags of node_id.
+    __fq1 __fq2 int find_in_node_set(input_ctx& in_ctx, trie_flags *&tf, uint64_t& bm_mask) {
+      bm_mask = bm_init_mask << (in_ctx.node_id % nodes_per_bv_block_n);
+      tf = get_trie_flags(in_ctx.node_id);
+      if (leaper != nullptr && (bm_mask & tf->bm_leaf) == 0 && (bm_mask & tf->bm_child) == 0) {
+        leaper->find_pos(in_ctx.node_id, trie_loc, in_ctx.key[in_ctx.key_pos]);
+        bm_mask = bm_init_mask << (in_ctx.node_id % nodes_per_bv_block_n);
+        tf = get_trie_flags(in_ctx.node_id);
+      }
+      uint32_t ptr_bit_count = UINT32_MAX;
+      do {
+        #if defined(__AVX2__) && !defined(__CUDA_ARCH__)
+        int scan_ret = scan_siblings(in_ctx, tf, bm_mask);
+        if (scan_ret == 0)
+          return 0;
+        if (scan_ret < 0)
+          continue;
+        #endif
+        if ((bm_mask & tf->bm_ptr) == 0) {
+          if (in_ctx.key[in_ctx.key_pos] == trie_loc[in_ctx.node_id]) {
+            in_ctx.key_pos++;
+            return 1;
+          }
+        } else {
+          uint32_t prev_key_pos = in_ctx.key_pos;
+          if (tail_map->compare_tail(in_ctx.node_id, in_ctx, ptr_bit_count))
+            return 1;
+          if (prev_key_pos != in_ctx.key_pos) {
+            in_ctx.key_pos = prev_key_pos;
+            return -1;
+          }
+        }
+        if (bm_mask & tf->bm_term)
+          return 0;
+        in_ctx.node_id++;
+        bm_mask <<= 1;
+        if (bm_mask == 0) {
+          bm_mask = bm_init_mask;
+          tf = next_trie_flags(tf);
+        }
+      } while (1);
+      return 0;
     }
 
-    __fq1 __fq2 uint8_t *get_trie_loc() {
-      return trie_loc;
+    // Finds the node under which all keys start with prefix. The prefix may
+    // end inside the tail of that node.
+    __fq1 __fq2 bool find_prefix_node(const uint8_t *prefix, size_t prefix_len, uint32_t& node_id) {
+      if (prefix_len == 0)
+        return false;
+      input_ctx in_ctx;
+      in_ctx.key = prefix;
+      in_ctx.key_len = prefix_len;
+      in_ctx.key_pos = 0;
+      in_ctx.node_id = 1;
+      trie_flags *tf;
+      uint64_t bm_mask;
+      while (1) {
+        int ret = find_in_node_set(in_ctx, tf, bm_mask);
+        if (ret == 0)
+          return false;
+        node_id = in_ctx.node_id;
+        if (ret < 0)
+          return prefix_ends_in_tail(node_id, prefix + in_ctx.key_pos, prefix_len - in_ctx.key_pos);
+        if (in_ctx.key_pos == prefix_len)
+          return true;
+        if ((bm_mask & tf->bm_child) == 0)
+          return false;
+        in_ctx.node_id = get_child_node_id(in_ctx.node_id);
+      }
+      return false;
     }
 
-    __fq1 __fq2 uint8_t *get_trie_bytes() {
-      return trie_bytes;
+    // Whether the tail of node_id is longer than and starts with prefix
+    __fq1 __fq2 bool prefix_ends_in_tail(uint32_t node_id, const uint8_t *prefix, size_t prefix_len) {
+      #if defined(__CUDA_ARCH__) || defined(__EMSCRIPTEN__)
+      uint8_t *tail_buf = new uint8_t[max_tail_len + 1];
+      #else
+      uint8_t tail_buf[max_tail_len + 1];
+      #endif
+      gen::byte_str tail(tail_buf, max_tail_len);
+      tail_map->get_tail_str(node_id, tail);
+      bool is_prefix = (tail.length() > prefix_len && cmn::memcmp(tail.data(), prefix, prefix_len) == 0);
+      #if defined(__CUDA_ARCH__) || defined(__EMSCRIPTEN__)
+      delete [] tail_buf;
+      #endif
+      return is_prefix;
     }
 
-    __fq1 __fq2 uint8_t *get_null_value(size_t& null_value_len) {
-      uint8_t *nv_loc = trie_bytes + cmn::read_uint32(trie_bytes + 124);
-      null_value_len = *nv_loc++;
-      return nv_loc;
+    // Set bits of lt before node_id without reading past the last node
+    __fq1 __fq2 static uint32_t rank1_before(bvlt_rank& lt, uint32_t node_id) {
+      if (node_id == 0)
+        return 0;
+      return lt.rank1(node_id - 1) + (lt[node_id - 1] ? 1 : 0);
+    }
+
+    // Counts the leaves under nodes from_node to to_node - 1. Child node sets of
+    // consecutive nodes are consecutive, so each level of the subtrees is one run
+    // of nodes found by rank and select. Nodes of the hot region keep their hot
+    // and cold children in two runs, the cold run is counted separately.
+    __fq1 __fq2 uint32_t count_leaves(uint32_t from_node, uint32_t to_node) {
+      uint32_t leaf_count = 0;
+      while (from_node < to_node) {
+        if (from_node < hot_node_count && to_node > hot_node_count) {
+          leaf_count += count_leaves(hot_node_count, to_node);
+          to_node = hot_node_count;
+        }
+        if (leaf_lt == nullptr)
+          leaf_count += (to_node - from_node);
+        else
+          leaf_count += (rank1_before(*leaf_lt, to_node) - leaf_lt->rank1(from_node));
+        uint32_t from_ns, to_ns;
+        if (from_node < hot_node_count) {
+          uint32_t from_hot = hot_child_lt.rank1(from_node);
+          uint32_t to_hot = rank1_before(hot_child_lt, to_node);
+          uint32_t from_cold = hot_ns_count + child_lt.rank1(from_node) - from_hot + 1;
+          uint32_t to_cold = hot_ns_count + rank1_before(child_lt, to_node) - to_hot + 1;
+          if (from_cold < to_cold)
+            leaf_count += count_leaves(term_lt.select1(from_cold), term_lt.select1(to_cold));
+          from_ns = from_hot + 1;
+          to_ns = to_hot + 1;
+        } else {
+          from_ns = child_lt.rank1(from_node) + 1;
+          to_ns = rank1_before(child_lt, to_node) + 1;
+        }
+        if (from_ns == to_ns)
+          break;
+        from_node = term_lt.select1(from_ns);
+        to_node = term_lt.select1(to_ns);
+      }
+      return leaf_count;
     }
 
-    __fq1 __fq2 uint8_t *get_empty_value(size_t& empty_value_len) {
-      uint8_t *ev_loc = trie_bytes + cmn::read_uint32(trie_bytes + 128);
-      empty_value_len = *ev_loc++;
-      return ev_loc;
+    // Number of keys starting with prefix, in O(depth) rank and select calls
+    // instead of iterating the keys
+    __fq1 __fq2 uint32_t count_prefix(const uint8_t *prefix, size_t prefix_len) {
+      uint32_t node_id = 1;
+      if (prefix_len == 0)
+        return count_leaves(node_id, term_lt.select1(2));
+      if (!find_prefix_node(prefix, prefix_len, node_id))
+        return 0;
+      return count_leaves(node_id, node_id + 1);
+    }
+
+    // Moves node_id from the start of a node set to its first node whose first
+    // byte is above key_byte (-1 for any). Returns 0 if there is one, else 2 with
+    // node_id at the last node. Only tails are read to get their first byte.
+    __fq1 __fq2 int seek_in_node_set(uint32_t& node_id, int key_byte, gen::byte_str& tail) {
+      do {
+        uint64_t bm_mask = bm_init_mask << (node_id % nodes_per_bv_block_n);
+        trie_flags *tf = get_trie_flags(node_id);
+        // leap nodes are neither leaf nor parent
+        if (bm_mask & (tf->bm_leaf | tf->bm_child)) {
+          int first_byte = trie_loc[node_id];
+          if (bm_mask & tf->bm_ptr) {
+            tail.clear();
+            tail_map->get_tail_str(node_id, tail);
+            first_byte = tail[0];
+          }
+          if (first_byte > key_byte)
+            return 0;
+        }
+        if (bm_mask & tf->bm_term)
+          return 2;
+        node_id++;
+      } while (1);
+      return 2;
+    }
+
+    // Descends along key to the first key >= key, or > key if after_eq. Positions
+    // ctx there for next() and sets key_pos_out to the number of keys before it in
+    // key order, each when not null. Returns false for tries built with
+    // sort_nodes_on_freq, whose node sets are not in key order.
+    __fq1 __fq2 bool seek_key(const uint8_t *key, size_t key_len, bool after_eq, iter_ctx *ctx, uint32_t *key_pos_out) {
+      if (opts->sort_nodes_on_freq)
+        return false;
+      #if defined(__CUDA_ARCH__) || defined(__EMSCRIPTEN__)
+      uint8_t *tail_buf = new uint8_t[max_tail_len + 1];
+      #else
+      uint8_t tail_buf[max_tail_len + 1];
+      #endif
+      gen::byte_str tail(tail_buf, max_tail_len);
+      if (ctx != nullptr)
+        ctx->init(max_key_len, max_level);
+      // position is at node_id (0), after the key of node_id (1) or after its subtree (2)
+      int pos_type = 0;
+      uint32_t keys_before = 0;
+      uint32_t ns_start = 1;
+      uint32_t node_id = 1;
+      input_ctx in_ctx;
+      in_ctx.key = key;
+      in_ctx.key_len = key_len;
+      in_ctx.key_pos = 0;
+      in_ctx.node_id = 1;
+      trie_flags *tf;
+      uint64_t bm_mask;
+      while (1) {
+        size_t key_pos = in_ctx.key_pos;
+        int ret = (key_pos < key_len ? find_in_node_set(in_ctx, tf, bm_mask) : 0);
+        if (ret == 0) {
+          // no node starts with the key byte, so stop at the first one after it
+          node_id = ns_start;
+          pos_type = seek_in_node_set(node_id, key_pos < key_len ? key[key_pos] : -1, tail);
+          break;
+        }
+        node_id = in_ctx.node_id;
+        if (ret < 0) {
+          tail.clear();
+          tail_map->get_tail_str(node_id, tail);
+          size_t cmp_len = tail.length() < key_len - key_pos ? tail.length() : key_len - key_pos;
+          pos_type = (cmn::memcmp(tail.data(), key + key_pos, cmp_len) < 0 ? 2 : 0);
+          break;
+        }
+        bool is_leaf = ((bm_mask & tf->bm_leaf) != 0);
+        if (in_ctx.key_pos == key_len) {
+          pos_type = (after_eq && is_leaf ? 1 : 0);
+          break;
+        }
+        if ((bm_mask & tf->bm_child) == 0) {
+          pos_type = 2;
+          break;
+        }
+        if (key_pos_out != nullptr)
+          keys_before += count_leaves(ns_start, node_id) + (is_leaf ? 1 : 0);
+        uint32_t child_node_id = get_child_node_id(node_id);
+        if (ctx != nullptr) {
+          tail.clear();
+          while (key_pos < in_ctx.key_pos)
+            tail.append(key[key_pos++]);
+          update_ctx(*ctx, tail, node_id);
+          push_to_ctx(*ctx, tail, child_node_id);
+        }
+        in_ctx.node_id = ns_start = child_node_id;
+      }
+      if (key_pos_out != nullptr) {
+        keys_before += count_leaves(ns_start, node_id);
+        if (pos_type == 1)
+          keys_before++;
+        if (pos_type == 2)
+          keys_before += count_leaves(node_id, node_id + 1);
+        *key_pos_out = keys_before;
+      }
+      if (ctx != nullptr) {
+        tail.clear();
+        if (pos_type == 2) {
+          while (term_lt[node_id]) {
+            if (ctx->cur_idx == 0) {
+              node_id = node_count - 1; // next() returns -2
+              break;
+            }
+            node_id = pop_from_ctx(*ctx, tail);
+          }
+          node_id++;
+        }
+        update_ctx(*ctx, tail, node_id);
+        ctx->to_skip_first_leaf = (pos_type == 1);
+      }
+      #if defined(__CUDA_ARCH__) || defined(__EMSCRIPTEN__)
+      delete [] tail_buf;
+      #endif
+      return true;
+    }
+
+    // Position ctx so that next() returns the keys >= key (lower_bound) or
+    // > key (upper_bound) in order, or -2 if there are none. Return 0, or -2
+    // without touching ctx if the trie was built with sort_nodes_on_freq.
+    __fq1 __fq2 int lower_bound(const uint8_t *key, size_t key_len, iter_ctx& ctx) {
+      return seek_key(key, key_len, false, &ctx, nullptr) ? 0 : -2;
+    }
+    __fq1 __fq2 int upper_bound(const uint8_t *key, size_t key_len, iter_ctx& ctx) {
+      return seek_key(key, key_len, true, &ctx, nullptr) ? 0 : -2;
+    }
+
+    // Positions [from_pos, to_pos) in key order of the keys with lo <= key < hi.
+    // Returns the count, which is how many keys next() reads after lower_bound(lo),
+    // or UINT32_MAX if the trie was built with sort_nodes_on_freq.
+    __fq1 __fq2 uint32_t range(const uint8_t *lo, size_t lo_len, const uint8_t *hi, size_t hi_len,
+                uint32_t& from_pos, uint32_t& to_pos) {
+      if (!seek_key(lo, lo_len, false, nullptr, &from_pos))
+        return UINT32_MAX;
+      seek_key(hi, hi_len, false, nullptr, &to_pos);
+      if (to_pos < from_pos)
+        to_pos = from_pos;
+      return to_pos - from_pos;
+    }
+
+    // Calls match_fn(uint32_t node_id, size_t prefix_len) for every key that is a
+    // prefix of key, shorter ones first, in a single descent along key. match_fn
+    // returns false to stop. Returns the number of calls made.
+    template <typename T>
+    __fq1 __fq2 uint32_t common_prefix_search(const uint8_t *key, size_t key_len, T match_fn) {
+      uint32_t match_count = 0;
+      input_ctx in_ctx;
+      in_ctx.key = key;
+      in_ctx.key_len = key_len;
+      in_ctx.key_pos = 0;
+      in_ctx.node_id = 1;
+      trie_flags *tf;
+      uint64_t bm_mask;
+      while (in_ctx.key_pos < key_len) {
+        if (find_in_node_set(in_ctx, tf, bm_mask) != 1)
+          break;
+        if (bm_mask & tf->bm_leaf) {
+          match_count++;
+          if (!match_fn(in_ctx.node_id, (size_t) in_ctx.key_pos))
+            break;
+        }
+        if ((bm_mask & tf->bm_child) == 0)
+          break;
+        in_ctx.node_id = get_child_node_id(in_ctx.node_id);
+      }
+      return match_count;
+    }
+
+    __fq1 __fq2 bvlt_select *get_leaf_lt() {
+      return leaf_lt;
+    }
+
+    __fq1 __fq2 uint8_t *get_trie_loc() {
+      return trie_loc;
+    }
+
+    __fq1 __fq2 uint8_t *get_trie_bytes() {
+      return trie_bytes;
+    }
+
+    __fq1 __fq2 uint8_t *get_null_value(size_t& null_value_len) {
+      uint8_t *nv_loc = trie_bytes + cmn::read_hdr_loc(trie_bytes, 124);
+      null_value_len = *nv_loc++;
+      return nv_loc;
+    }
+
+    __fq1 __fq2 uint8_t *get_empty_value(size_t& empty_value_len) {
+      uint8_t *ev_loc = trie_bytes + cmn::read_hdr_loc(trie_bytes, 128);
+      empty_value_len = *ev_loc++;
+      return ev_loc;
     }
 
     __fq1 __fq2 void load_static_trie(uint8_t *_trie_bytes = nullptr) {
@@ -1702,15 +2755,15 @@ class static_trie : public inner_trie {
         trie_bytes = _trie_bytes;
 
       load_inner_trie(trie_bytes);
-      opts = (bldr_options *) (trie_bytes + cmn::read_uint32(trie_bytes + 20));
+      opts = (bldr_options *) (trie_bytes + cmn::read_hdr_loc(trie_bytes, 20));
       key_count = cmn::read_uint32(trie_bytes + 28);
       if (key_count > 0) {
         max_tail_len = cmn::read_uint16(trie_bytes + 40) + 1;
 
         uint32_t node_set_count = cmn::read_uint32(trie_bytes + 24);
-        uint8_t *leaf_select_lkup_loc = trie_bytes + cmn::read_uint32(trie_bytes + 92);
-        uint8_t *leaf_lt_loc = trie_bytes + cmn::read_uint32(trie_bytes + 96);
-        uint64_t *tf_loc = (uint64_t *) (trie_bytes + cmn::read_uint32(trie_bytes + 116));
+        uint8_t *leaf_select_lkup_loc = trie_bytes + cmn::read_hdr_loc(trie_bytes, 92);
+        uint8_t *leaf_lt_loc = trie_bytes + cmn::read_hdr_loc(trie_bytes, 96);
+        uint64_t *tf_loc = (uint64_t *) (trie_bytes + cmn::read_hdr_loc(trie_bytes, 116));
         trie_flags_loc = (trie_flags *) tf_loc;
 
         if (leaf_select_lkup_loc == trie_bytes) leaf_select_lkup_loc = nullptr;
@@ -1722,7 +2775,10 @@ class static_trie : public inner_trie {
             leaf_select_lkup_loc = lt_builder::create_select_lt_from_trie(BV_LT_TYPE_LEAF, key_count, node_set_count, node_count, tf_loc);
           }
           leaf_lt = new bvlt_select();
-          leaf_lt->init(leaf_lt_loc, leaf_select_lkup_loc, node_count, tf_loc + 3, 4, 1);
+          leaf_lt->init(leaf_lt_loc, leaf_select_lkup_loc, node_count, tf_loc + TF_LEAF, tf_multiplier, 1);
+          if (opts->inline_rank)
+            leaf_lt->set_inline_rank(tf_loc, TF_LEAF);
+          leaf_lt->init_select_index();
         }
       }
 
@@ -1731,12 +2787,12 @@ class static_trie : public inner_trie {
         max_level = cmn::read_uint16(trie_bytes + 42);
         uint32_t fwd_cache_count = cmn::read_uint32(trie_bytes + 44);
         uint32_t fwd_cache_max_node_id = cmn::read_uint32(trie_bytes + 52);
-        uint8_t *fwd_cache_loc = trie_bytes + cmn::read_uint32(trie_bytes + 64);
+        uint8_t *fwd_cache_loc = trie_bytes + cmn::read_hdr_loc(trie_bytes, 64);
         fwd_cache.init(fwd_cache_loc, fwd_cache_count, fwd_cache_max_node_id);
 
         min_pos_stats min_stats;
         memcpy(&min_stats, trie_bytes + 60, 4);
-        uint8_t *min_pos_loc = trie_bytes + cmn::read_uint32(trie_bytes + 72);
+        uint8_t *min_pos_loc = trie_bytes + cmn::read_hdr_loc(trie_bytes, 72);
         if (min_pos_loc == trie_bytes)
           min_pos_loc = nullptr;
         if (min_pos_loc != nullptr) {
@@ -1748,6 +2804,19 @@ class static_trie : public inner_trie {
           }
         }
 
+        uint64_t hot_ns_loc = cmn::read_hdr_loc(trie_bytes, 132);
+        if (hot_ns_loc > 0) {
+          uint8_t *hot_ns = trie_bytes + hot_ns_loc;
+          hot_ns_count = cmn::read_uint32(hot_ns);
+          hot_node_count = cmn::read_uint32(hot_ns + 4);
+          hot_cold_ns_limit = hot_ns_count + cmn::read_uint32(hot_ns + 8);
+          hot_child_lt.init(hot_ns + cmn::read_uint32(hot_ns + 16), hot_ns + cmn::read_uint32(hot_ns + 12),
+                  hot_node_count, (uint64_t *) (hot_ns + cmn::read_uint32(hot_ns + 28)), 1, 1);
+          cold_child_lt.init(hot_ns + cmn::read_uint32(hot_ns + 24), hot_ns + cmn::read_uint32(hot_ns + 20),
+                  hot_node_count, (uint64_t *) (hot_ns + cmn::read_uint32(hot_ns + 32)), 1, 1);
+        }
+
+        select_lookup_fn(fwd_cache_max_node_id > 0);
       }
 
     }
@@ -1766,8 +2835,16 @@ class static_trie : public inner_trie {
 
       max_tail_len = 0;
       tail_map = nullptr;
+      lt_not_given = 0;
       trie_loc = nullptr;
       leaf_lt = nullptr;
+      fwd_overlay = nullptr;
+      tf_multiplier = 4;
+      hot_ns_count = hot_node_count = hot_cold_ns_limit = 0;
+
+      lookup_fn = &static_trie::lookup_t<MDX_LEAP_ANY, true, tail_ptr_map, true>;
+      lookup_step_fn = &static_trie::lookup_step_t<MDX_LEAP_ANY, true, tail_ptr_map, true>;
+      lookup_step_defer_fn = &static_trie::lookup_step_t<MDX_LEAP_ANY, true, tail_ptr_map, true, true>;
 
     }
 
@@ -1784,16 +2861,139 @@ class static_trie : public inner_trie {
 
 };
 
+// Position in a numeric column for reading it row after row, see static_trie_map::next_col_val()
+struct col_iter_ctx {
+  int col_val_idx;
+  uint32_t row;
+  uint32_t node_id; // next node to visit, for delta columns
+  uint32_t ptr_pos;
+  uint32_t ptr_bit_count;
+  uint64_t bm_leaf;
+  int64_t col_val; // running sum of the deltas in the current bv block
+};
+
+#ifndef MDX_AGG_SLOTS
+#define MDX_AGG_SLOTS 256
+#endif
+#ifndef MDX_FILTER_MEMO_SLOTS
+#define MDX_FILTER_MEMO_SLOTS 4096
+#endif
+
+// Result of static_trie_map::aggregate(). Values are kept as stored,
+// so decimals are scaled by 10^(data_type - MST_DEC0), see to_double()
+struct col_agg {
+  uint32_t count;
+  uint32_t null_count;
+  int64_t sum;
+  int64_t min_val;
+  int64_t max_val;
+  uint8_t data_type;
+  __fq1 __fq2 void reset(uint8_t _data_type) {
+    count = null_count = 0;
+    sum = 0;
+    min_val = INT64_MAX;
+    max_val = INT64_MIN;
+    data_type = _data_type;
+  }
+  __fq1 __fq2 void add(int64_t val, uint32_t freq) {
+    count += freq;
+    sum += val * freq;
+    if (min_val > val)
+      min_val = val;
+    if (max_val < val)
+      max_val = val;
+  }
+  __fq1 __fq2 double to_double(int64_t val) {
+    if (data_type >= MST_DEC0 && data_type <= MST_DEC9)
+      return static_cast<double>(val) / gen::pow10(data_type - MST_DEC0);
+    return static_cast<double>(val);
+  }
+};
+
+// Predicates for static_trie_map::filter_eq(), filter_prefix() and filter_in()
+struct text_eq_pred {
+  const uint8_t *val;
+  size_t val_len;
+  __fq1 __fq2 bool operator()(const uint8_t *col_val, size_t col_len) {
+    return col_len == val_len && cmn::memcmp(col_val, val, val_len) == 0;
+  }
+};
+struct text_prefix_pred {
+  const uint8_t *prefix;
+  size_t prefix_len;
+  __fq1 __fq2 bool operator()(const uint8_t *col_val, size_t col_len) {
+    return col_len >= prefix_len && cmn::memcmp(col_val, prefix, prefix_len) == 0;
+  }
+};
+struct text_in_pred {
+  const uint8_t **vals;
+  const size_t *val_lens;
+  size_t val_count;
+  __fq1 __fq2 bool operator()(const uint8_t *col_val, size_t col_len) {
+    for (size_t i = 0; i < val_count; i++) {
+      if (col_len == val_lens[i] && cmn::memcmp(col_val, vals[i], col_len) == 0)
+        return true;
+    }
+    return false;
+  }
+};
+
+// Predicate results by value for the filters. One can be passed to successive
+// calls over blocks of rows of a column with the same predicate, so it is
+// allocated once. It is reset when used for another column, call reset() when
+// the predicate changes.
+class filter_memo {
+  private:
+    __fq1 __fq2 filter_memo(filter_memo const&);
+    __fq1 __fq2 filter_memo& operator=(filter_memo const&);
+  public:
+    uintptr_t *keys;
+    uint8_t *matches;
+    uint8_t *val_buf;
+    size_t val_buf_len;
+    const void *owner;
+    __fq1 __fq2 filter_memo() {
+      keys = new uintptr_t[MDX_FILTER_MEMO_SLOTS]();
+      matches = new uint8_t[MDX_FILTER_MEMO_SLOTS];
+      val_buf = nullptr;
+      val_buf_len = 0;
+      owner = nullptr;
+    }
+    __fq1 __fq2 ~filter_memo() {
+      delete [] keys;
+      delete [] matches;
+      if (val_buf != nullptr)
+        delete [] val_buf;
+    }
+    __fq1 __fq2 void reset() {
+      memset(keys, '\0', MDX_FILTER_MEMO_SLOTS * sizeof(uintptr_t));
+      owner = nullptr;
+    }
+    __fq1 __fq2 void init(const void *_owner, size_t _val_buf_len) {
+      if (owner != _owner)
+        reset();
+      owner = _owner;
+      if (val_buf_len < _val_buf_len) {
+        if (val_buf != nullptr)
+          delete [] val_buf;
+        val_buf = new uint8_t[_val_buf_len + 1];
+        val_buf_len = _val_buf_len;
+      }
+    }
+};
+
 class val_ptr_group_map : public ptr_group_map {
   private:
     __fq1 __fq2 val_ptr_group_map(val_ptr_group_map const&);
     __fq1 __fq2 val_ptr_group_map& operator=(val_ptr_group_map const&);
-    std::vector<uint8_t> prev_val;
     uint32_t node_count;
     uint32_t key_count;
     gen::int_bv_reader int_ptr_bv;
     static_trie *col_trie;
     static_trie *col_trie_rev;
+    uint8_t *delta_ckpts_loc;
+    uint8_t *zone_map_loc;
+    uint8_t *postings_loc;
   public:
     __fq1 __fq2 uint32_t scan_ptr_bits_val(uint32_t node_id, uint32_t ptr_bit_count) {
       uint32_t node_id_from = node_id - (node_id % nodes_per_ptr_block_n);
@@ -1873,47 +3073,87 @@ class val_ptr_group_map : public ptr_group_map {
       }
       if (*p_ptr_bit_count == UINT32_MAX)
         *p_ptr_bit_count = get_ptr_bit_count_val(node_id);
-      uint8_t code = ptr_reader.read8(*p_ptr_bit_count);
+      return read_val_loc(*p_ptr_bit_count, *p_grp_no);
+    }
+
+    // Reads the ptr at ptr_bit_count, leaving it at the ptr of the next value
+    __fq1 __fq2 uint8_t *read_val_loc(uint32_t& ptr_bit_count, uint8_t& grp_no) {
+      uint8_t code = ptr_reader.read8(ptr_bit_count);
       uint8_t bit_len = code_lt_bit_len[code];
-      *p_grp_no = code_lt_code_len[code] & 0x0F;
+      grp_no = code_lt_code_len[code] & 0x0F;
       uint8_t code_len = code_lt_code_len[code] >> 4;
-      *p_ptr_bit_count += code_len;
-      uint32_t ptr = ptr_reader.read(*p_ptr_bit_count, bit_len - code_len);
-      if (*p_grp_no < grp_idx_limit)
-        ptr = read_ptr_from_idx(*p_grp_no, ptr);
-      return grp_data[*p_grp_no] + ptr;
+      ptr_bit_count += code_len;
+      uint32_t ptr = ptr_reader.read(ptr_bit_count, bit_len - code_len);
+      if (grp_no < grp_idx_limit)
+        ptr = read_ptr_from_idx(grp_no, ptr);
+      return grp_data[grp_no] + ptr;
     }
 
-    __fq1 __fq2 void get_delta_val(uint32_t node_id, size_t *in_size_out_value_len, void *ret_val) {
-      uint8_t *val_loc;
-      uint32_t ptr_bit_count = UINT32_MAX;
-      uint32_t delta_node_id = node_id / nodes_per_bv_block_n;
-      delta_node_id *= nodes_per_bv_block_n;
-      uint64_t bm_mask = bm_init_mask;
-      uint64_t bm_leaf = UINT64_MAX;
+    // Location of the value at ptr_pos (leaf rank or node id), advancing to the next one
+    __fq1 __fq2 uint8_t *next_val_loc(uint32_t& ptr_pos, uint32_t& ptr_bit_count, uint8_t *p_grp_no = nullptr) {
+      uint8_t grp_no = 0;
+      if (p_grp_no == nullptr)
+        p_grp_no = &grp_no;
+      if (group_count == 1) {
+        *p_grp_no = 0;
+        uint32_t ptr = int_ptr_bv[ptr_pos++];
+        if (*p_grp_no < grp_idx_limit)
+          ptr = read_ptr_from_idx(*p_grp_no, ptr);
+        return grp_data[0] + ptr;
+      }
+      ptr_pos++;
+      return read_val_loc(ptr_bit_count, *p_grp_no);
+    }
+
+    // Adds the delta of ctx.node_id if it is a leaf and moves to the next node
+    __fq1 __fq2 bool step_delta(col_iter_ctx& ctx) {
+      uint32_t bit_pos = ctx.node_id % nodes_per_bv_block_n;
+      if (bit_pos == 0) {
+        ctx.col_val = 0;
+        if (key_count > 0)
+          ctx.bm_leaf = ptr_bm_loc[(ctx.node_id / nodes_per_bv_block_n) * multiplier];
+      }
+      ctx.node_id++;
+      if ((ctx.bm_leaf & (bm_init_mask << bit_pos)) == 0)
+        return false;
+      uint64_t u64;
+      flavic48::simple_decode_single(next_val_loc(ctx.ptr_pos, ctx.ptr_bit_count), &u64);
+      ctx.col_val += flavic48::cvt2_i64(u64);
+      return true;
+    }
+
+    // Positions ctx at node_id, summing deltas from the closest checkpoint
+    // (or the start of the bv block for files without checkpoints)
+    __fq1 __fq2 void seek_delta(col_iter_ctx& ctx, uint32_t node_id) {
+      ctx.node_id = node_id - (node_id % nodes_per_bv_block_n);
+      ctx.col_val = 0;
+      uint32_t sub_block = (node_id % nodes_per_bv_block_n) / MDX_DELTA_CKPT_NODES;
+      if (delta_ckpts_loc != nullptr && sub_block > 0) {
+        size_t ckpt_idx = (node_id / nodes_per_bv_block_n) * MDX_DELTA_CKPTS_PER_BLOCK + sub_block - 1;
+        ctx.col_val = (int64_t) cmn::read_uint64(delta_ckpts_loc + ckpt_idx * sizeof(uint64_t));
+        ctx.node_id += sub_block * MDX_DELTA_CKPT_NODES;
+      }
+      ctx.ptr_pos = ctx.node_id;
       if (key_count > 0)
-        bm_leaf = ptr_bm_loc[(node_id / nodes_per_bv_block_n) * multiplier];
-      int64_t col_val = 0;
-      do {
-        // printf("Delta Node-id: %u\n", delta_node_id);
-        if (bm_mask & bm_leaf) {
-          val_loc = get_val_loc(delta_node_id, &ptr_bit_count);
-          if (val_loc != nullptr) {
-            uint64_t u64;
-            uint8_t frac_width = flavic48::simple_decode_single(val_loc, &u64);
-            int64_t delta_val = flavic48::cvt2_i64(u64);
-            // printf("Delta node id: %u, value: %lld\n", delta_node_id, delta_val);
-            col_val += delta_val;
-          }
-        }
-        bm_mask <<= 1;
-      } while (delta_node_id++ < node_id);
+        ctx.ptr_pos = ((static_trie *) dict_obj)->get_leaf_lt()->rank1(ctx.node_id);
+      ctx.ptr_bit_count = group_count == 1 ? 0 : get_ptr_bit_count_val(ctx.node_id);
+      ctx.bm_leaf = UINT64_MAX;
+      if (key_count > 0)
+        ctx.bm_leaf = ptr_bm_loc[(node_id / nodes_per_bv_block_n) * multiplier];
+      while (ctx.node_id < node_id)
+        step_delta(ctx);
+    }
+
+    __fq1 __fq2 void get_delta_val(uint32_t node_id, size_t *in_size_out_value_len, void *ret_val) {
+      col_iter_ctx ctx;
+      seek_delta(ctx, node_id);
+      step_delta(ctx);
       *in_size_out_value_len = 8;
       if (data_type == MST_INT) {
-        *((int64_t *) ret_val) = col_val;
+        *((int64_t *) ret_val) = ctx.col_val;
         return;
       }
-      double dbl = static_cast<double>(col_val);
+      double dbl = static_cast<double>(ctx.col_val);
       dbl /= gen::pow10(data_type - MST_DEC0);
       *((double *)ret_val) = dbl;
     }
@@ -1927,19 +3167,27 @@ class val_ptr_group_map : public ptr_group_map {
       col_trie->reverse_lookup_from_node_id(col_trie_node_id, in_size_out_value_len, (uint8_t *) ret_val, true);
     }
 
+    // Returns false if the value is null
+    __fq1 __fq2 static bool decode_i64(uint8_t *val_loc, int64_t& i64) {
+      if (*val_loc == 0xF8)
+        return false;
+      uint64_t u64;
+      flavic48::simple_decode(val_loc, 1, &u64);
+      i64 = flavic48::cvt2_i64(u64);
+      return true;
+    }
+
     __fq1 __fq2 void convert_back(uint8_t *val_loc, void *ret_val, size_t& ret_len) {
       ret_len = 8;
       switch (data_type) {
         case MST_INT:
         case MST_DECV ... MST_DEC9:
         case MST_DATE_US ... MST_DATETIME_ISOT_MS: {
-          if (*val_loc == 0xF8) {
+          int64_t i64;
+          if (!decode_i64(val_loc, i64)) {
             ret_len = 0;
             return;
           }
-          uint64_t u64;
-          flavic48::simple_decode(val_loc, 1, &u64);
-          int64_t i64 = flavic48::cvt2_i64(u64);
           if (data_type >= MST_DEC0 && data_type <= MST_DEC9) {
             double dbl = static_cast<double>(i64);
             dbl /= gen::pow10(data_type - MST_DEC0);
@@ -1970,11 +3218,7 @@ class val_ptr_group_map : public ptr_group_map {
             uint8_t val_str_buf[max_len];
             #endif
             gen::byte_str val_str(val_str_buf, max_len);
-            uint8_t *val_start = grp_data[grp_no];
-            if (*val_start != 0)
-              inner_tries[grp_no]->copy_trie_tail(val_loc - val_start, val_str);
-            else
-              get_val_str(val_str, val_loc - val_start, grp_no, max_len);
+            get_text_val(val_loc, grp_no, val_str);
             size_t val_len = val_str.length();
             *in_size_out_value_len = val_len;
             memcpy(ret_val, val_str.data(), val_len);
@@ -1997,6 +3241,346 @@ class val_ptr_group_map : public ptr_group_map {
         }
       }
     }
+
+    __fq1 __fq2 uint32_t get_row_count() {
+      return key_count > 0 ? key_count : node_count;
+    }
+
+    // Positions ctx at start_row (node id when there are no keys, leaf id otherwise)
+    __fq1 __fq2 void init_iter(col_iter_ctx& ctx, uint32_t start_row) {
+      ctx.row = start_row;
+      ctx.ptr_pos = start_row;
+      ctx.ptr_bit_count = 0;
+      if (start_row >= get_row_count()) {
+        ctx.row = get_row_count();
+        return;
+      }
+      if (encoding_type == MSE_TRIE || encoding_type == MSE_TRIE_2WAY)
+        return;
+      uint32_t node_id = start_row;
+      if (key_count > 0)
+        node_id = ((static_trie *) dict_obj)->get_leaf_lt()->select1(start_row + 1) - 1;
+      if (encoding_type == MSE_DICT_DELTA)
+        seek_delta(ctx, node_id);
+      else if (group_count > 1)
+        ctx.ptr_bit_count = get_ptr_bit_count_val(node_id);
+    }
+
+    // Decodes the value at ctx and moves to the next row. Returns false if the value is null
+    __fq1 __fq2 bool next_i64(col_iter_ctx& ctx, int64_t& i64) {
+      ctx.row++;
+      if (encoding_type == MSE_DICT_DELTA) {
+        while (!step_delta(ctx))
+          ; // skip non-leaf nodes
+        i64 = ctx.col_val;
+        return true;
+      }
+      if (encoding_type == MSE_TRIE || encoding_type == MSE_TRIE_2WAY) {
+        uint8_t val_buf[32]; // numbers are stored in at most 9 bytes
+        size_t val_len = sizeof(val_buf);
+        col_trie->reverse_lookup_from_node_id(int_ptr_bv[ctx.ptr_pos++], &val_len, val_buf, true);
+        return val_len > 0 && decode_i64(val_buf, i64);
+      }
+      return decode_i64(next_val_loc(ctx.ptr_pos, ctx.ptr_bit_count), i64);
+    }
+
+    // Same output as get_val() for the row at ctx. Returns false after the last row
+    __fq1 __fq2 bool iter_next(col_iter_ctx& ctx, size_t *out_value_len, void *ret_val) {
+      if (ctx.row >= get_row_count() || data_type == MST_TEXT || data_type == MST_BIN)
+        return false;
+      int64_t i64;
+      *out_value_len = 8;
+      if (!next_i64(ctx, i64)) {
+        *out_value_len = 0;
+        return true;
+      }
+      if (data_type >= MST_DEC0 && data_type <= MST_DEC9) {
+        double dbl = static_cast<double>(i64);
+        dbl /= gen::pow10(data_type - MST_DEC0);
+        *((double *)ret_val) = dbl;
+      } else
+        memcpy(ret_val, &i64, sizeof(int64_t));
+      return true;
+    }
+
+    // Decodes the value of a ptr returned by next_val_key()
+    __fq1 __fq2 bool decode_key(uintptr_t val_key, int64_t& i64) {
+      if (encoding_type == MSE_TRIE || encoding_type == MSE_TRIE_2WAY) {
+        uint8_t val_buf[32];
+        size_t val_len = sizeof(val_buf);
+        col_trie->reverse_lookup_from_node_id(val_key - 1, &val_len, val_buf, true);
+        return val_len > 0 && decode_i64(val_buf, i64);
+      }
+      return decode_i64((uint8_t *) val_key, i64);
+    }
+    // Identifies the distinct value at ctx without decoding it and moves to the next row
+    __fq1 __fq2 uintptr_t next_val_key(col_iter_ctx& ctx) {
+      ctx.row++;
+      if (encoding_type == MSE_TRIE || encoding_type == MSE_TRIE_2WAY)
+        return int_ptr_bv[ctx.ptr_pos++] + 1;
+      return (uintptr_t) next_val_loc(ctx.ptr_pos, ctx.ptr_bit_count);
+    }
+    __fq1 __fq2 void add_to_agg(col_agg& agg, uintptr_t val_key, uint32_t freq) {
+      int64_t i64;
+      if (decode_key(val_key, i64))
+        agg.add(i64, freq);
+      else
+        agg.null_count += freq;
+    }
+
+    // Adds count rows from start_row to agg. Except for delta columns, rows are
+    // only counted per distinct value and each value is decoded once per slot
+    // eviction instead of once per row.
+    __fq1 __fq2 uint32_t aggregate(uint32_t start_row, uint32_t count, col_agg& agg) {
+      if (data_type == MST_TEXT || data_type == MST_BIN)
+        return 0;
+      uint32_t row_count = get_row_count();
+      if (start_row >= row_count)
+        return 0;
+      if (count > row_count - start_row)
+        count = row_count - start_row;
+      col_iter_ctx ctx;
+      init_iter(ctx, start_row);
+      if (encoding_type == MSE_DICT_DELTA) {
+        for (uint32_t i = 0; i < count; i++) {
+          int64_t i64 = 0;
+          if (next_i64(ctx, i64))
+            agg.add(i64, 1);
+          else
+            agg.null_count++;
+        }
+        return count;
+      }
+      uintptr_t slot_keys[MDX_AGG_SLOTS];
+      uint32_t slot_freqs[MDX_AGG_SLOTS];
+      memset(slot_keys, '\0', sizeof(slot_keys));
+      for (uint32_t i = 0; i < count; i++) {
+        uintptr_t val_key = next_val_key(ctx);
+        uint32_t slot = (uint32_t) (((uint64_t) val_key * 0x9E3779B97F4A7C15ULL) >> 40) % MDX_AGG_SLOTS;
+        if (slot_keys[slot] == val_key) {
+          slot_freqs[slot]++;
+          continue;
+        }
+        if (slot_keys[slot] != 0)
+          add_to_agg(agg, slot_keys[slot], slot_freqs[slot]);
+        slot_keys[slot] = val_key;
+        slot_freqs[slot] = 1;
+      }
+      for (size_t i = 0; i < MDX_AGG_SLOTS; i++) {
+        if (slot_keys[i] != 0)
+          add_to_agg(agg, slot_keys[i], slot_freqs[i]);
+      }
+      return count;
+    }
+
+    // Calls match_fn(row, value) for every non-null value within [lo, hi]
+    // until it returns false. Values are in stored form as in col_agg.
+    // Blocks of MDX_ZONE_ROWS rows outside the range are skipped using the zone map
+    template <typename T>
+    __fq1 __fq2 uint32_t scan_where(int64_t lo, int64_t hi, T match_fn) {
+      if (data_type == MST_TEXT || data_type == MST_BIN)
+        return 0;
+      uint32_t row_count = get_row_count();
+      uint32_t block_rows = zone_map_loc == nullptr ? row_count : MDX_ZONE_ROWS;
+      uint32_t match_count = 0;
+      col_iter_ctx ctx;
+      for (uint32_t start_row = 0; start_row < row_count; start_row += block_rows) {
+        if (zone_map_loc != nullptr) {
+          uint8_t *zone = zone_map_loc + (start_row / MDX_ZONE_ROWS) * MDX_ZONE_ENTRY_SIZE;
+          if ((int64_t) cmn::read_uint64(zone) > hi || (int64_t) cmn::read_uint64(zone + 8) < lo)
+            continue;
+        }
+        uint32_t end_row = start_row + block_rows;
+        if (end_row > row_count)
+          end_row = row_count;
+        init_iter(ctx, start_row);
+        for (uint32_t row = start_row; row < end_row; row++) {
+          int64_t i64;
+          if (!next_i64(ctx, i64) || i64 < lo || i64 > hi)
+            continue;
+          match_count++;
+          if (!match_fn(row, i64))
+            return match_count;
+        }
+      }
+      return match_count;
+    }
+
+    // Decodes count values of a numeric column from start_row into out_vals
+    // as int64_t, or double for MST_DEC0..9.
+    // Bit i of null_bm, if given, is set when row start_row + i is null.
+    // Ptrs are read one after the other from the first row, so nothing is looked up per row.
+    // Returns the number of rows decoded, 0 for text columns.
+    __fq1 __fq2 uint32_t decode_range(uint32_t start_row, uint32_t count, void *out_vals, uint64_t *null_bm = nullptr) {
+      if (data_type == MST_TEXT || data_type == MST_BIN)
+        return 0;
+      uint32_t row_count = get_row_count();
+      if (start_row >= row_count)
+        return 0;
+      if (count > row_count - start_row)
+        count = row_count - start_row;
+      if (null_bm != nullptr)
+        memset(null_bm, '\0', ((count + 63) / 64) * sizeof(uint64_t));
+      int64_t *i64_vals = (int64_t *) out_vals;
+      col_iter_ctx ctx;
+      init_iter(ctx, start_row);
+      for (uint32_t i = 0; i < count; i++) {
+        if (!next_i64(ctx, i64_vals[i])) {
+          i64_vals[i] = 0;
+          if (null_bm != nullptr)
+            null_bm[i / 64] |= (bm_init_mask << (i % 64));
+        }
+      }
+      if (data_type >= MST_DEC0 && data_type <= MST_DEC9) {
+        double divisor = gen::pow10(data_type - MST_DEC0);
+        double *dbl_vals = (double *) out_vals;
+        for (uint32_t i = 0; i < count; i++)
+          dbl_vals[i] = static_cast<double>(i64_vals[i]) / divisor;
+      }
+      return count;
+    }
+
+    __fq1 __fq2 void get_text_val(uint8_t *val_loc, uint8_t grp_no, gen::byte_str& val_str) {
+      uint8_t *val_start = grp_data[grp_no];
+      if (*val_start != 0)
+        inner_tries[grp_no]->copy_trie_tail(val_loc - val_start, val_str);
+      else
+        get_val_str(val_str, val_loc - val_start, grp_no, max_len);
+    }
+
+    // Writes to sel_vec the rows among count rows from start_row whose text value
+    // satisfies pred_fn(val, len). pred_fn is evaluated once per distinct value
+    // (per memo slot), other rows only read their ptr codes. Uses a memo of its
+    // own when memo is nullptr.
+    template <typename T>
+    __fq1 __fq2 uint32_t filter_text(uint32_t start_row, uint32_t count, T& pred_fn, uint32_t *sel_vec,
+                filter_memo *memo = nullptr) {
+      if ((data_type != MST_TEXT && data_type != MST_BIN) || encoding_type == MSE_WORDS)
+        return 0;
+      uint32_t row_count = get_row_count();
+      if (start_row >= row_count)
+        return 0;
+      if (count > row_count - start_row)
+        count = row_count - start_row;
+      bool is_col_trie = (encoding_type == MSE_TRIE || encoding_type == MSE_TRIE_2WAY);
+      size_t val_buf_len = max_len;
+      if (is_col_trie && val_buf_len < col_trie->get_max_key_len())
+        val_buf_len = col_trie->get_max_key_len();
+      filter_memo *own_memo = nullptr;
+      if (memo == nullptr) {
+        own_memo = new filter_memo();
+        memo = own_memo;
+      }
+      memo->init(this, val_buf_len);
+      uint8_t *val_buf = memo->val_buf;
+      uintptr_t *memo_keys = memo->keys;
+      uint8_t *memo_matches = memo->matches;
+      col_iter_ctx ctx;
+      init_iter(ctx, start_row);
+      uint32_t match_count = 0;
+      for (uint32_t i = 0; i < count; i++) {
+        uintptr_t val_key;
+        uint8_t grp_no = 0;
+        if (is_col_trie)
+          val_key = int_ptr_bv[ctx.ptr_pos++] + 1;
+        else
+          val_key = (uintptr_t) next_val_loc(ctx.ptr_pos, ctx.ptr_bit_count, &grp_no);
+        uint32_t slot = (uint32_t) (((uint64_t) val_key * 0x9E3779B97F4A7C15ULL) >> 40) % MDX_FILTER_MEMO_SLOTS;
+        if (memo_keys[slot] != val_key) {
+          size_t val_len = val_buf_len;
+          if (is_col_trie)
+            col_trie->reverse_lookup_from_node_id(val_key - 1, &val_len, val_buf, true);
+          else {
+            gen::byte_str val_str(val_buf, val_buf_len);
+            get_text_val((uint8_t *) val_key, grp_no, val_str);
+            val_len = val_str.length();
+          }
+          memo_keys[slot] = val_key;
+          memo_matches[slot] = pred_fn(val_buf, val_len);
+        }
+        if (memo_matches[slot])
+          sel_vec[match_count++] = start_row + i;
+      }
+      if (own_memo != nullptr)
+        delete own_memo;
+      return match_count;
+    }
+
+    // Decodes up to max_rows row ids of an Elias-Fano posting list (see
+    // builder::append_ef_list()) to out_rows and returns the list length
+    __fq1 __fq2 static uint32_t decode_postings(uint8_t *list_loc, uint32_t *out_rows, uint32_t max_rows) {
+      uint64_t hdr = cmn::read_uint64(list_loc);
+      uint32_t n = (uint32_t) hdr;
+      uint8_t l = (uint8_t) (hdr >> 32);
+      uint8_t *low_loc = list_loc + 8;
+      uint8_t *high_loc = low_loc + (((uint64_t) n * l + 63) / 64) * 8;
+      uint64_t low_mask = (1ULL << l) - 1;
+      uint32_t count = n < max_rows ? n : max_rows;
+      uint32_t word_idx = 0;
+      uint64_t word = cmn::read_uint64(high_loc);
+      for (uint32_t i = 0; i < count; i++) {
+        while (word == 0)
+          word = cmn::read_uint64(high_loc + (++word_idx) * 8);
+        uint64_t high_pos = word_idx * 64 + __builtin_ctzll(word);
+        word &= (word - 1);
+        uint32_t row = (uint32_t) ((high_pos - i) << l);
+        if (l > 0) {
+          uint64_t bit_pos = (uint64_t) i * l;
+          uint64_t low = cmn::read_uint64(low_loc + (bit_pos / 64) * 8) >> (bit_pos % 64);
+          if (bit_pos % 64 + l > 64)
+            low |= (cmn::read_uint64(low_loc + (bit_pos / 64 + 1) * 8) << (64 - bit_pos % 64));
+          row |= (uint32_t) (low & low_mask);
+        }
+        out_rows[i] = row;
+      }
+      return n;
+    }
+
+    // Writes up to max_rows ids of the rows having the col trie value
+    // col_trie_node_id to out_rows, in order, and returns how many there are
+    __fq1 __fq2 uint32_t get_node_rows(uint32_t col_trie_node_id, uint32_t *out_rows, uint32_t max_rows) {
+      if (postings_loc == nullptr || col_trie_node_id >= cmn::read_uint32(postings_loc))
+        return 0;
+      uint32_t list_loc = cmn::read_uint32(postings_loc + 8 + col_trie_node_id * 4);
+      if (list_loc == cmn::read_uint32(postings_loc + 12 + col_trie_node_id * 4))
+        return 0;
+      return decode_postings(postings_loc + list_loc, out_rows, max_rows);
+    }
+
+    // Rows having value val, as stored in the col trie. Only MSE_TRIE_2WAY columns have postings.
+    __fq1 __fq2 uint32_t get_value_rows(const uint8_t *val, size_t val_len, uint32_t *out_rows, uint32_t max_rows) {
+      if (postings_loc == nullptr)
+        return 0;
+      input_ctx in_ctx;
+      in_ctx.key = val;
+      in_ctx.key_len = val_len;
+      in_ctx.node_id = 0;
+      if (!col_trie->lookup(in_ctx))
+        return 0;
+      return get_node_rows(in_ctx.node_id, out_rows, max_rows);
+    }
+
+    // Rows of all values starting with prefix, value after value, so rows are
+    // sorted only within a value. Returns the total even if more than max_rows.
+    __fq1 __fq2 uint32_t get_prefix_rows(const uint8_t *prefix, size_t prefix_len, uint32_t *out_rows, uint32_t max_rows) {
+      if (postings_loc == nullptr)
+        return 0;
+      iter_ctx ctx;
+      if (col_trie->lower_bound(prefix, prefix_len, ctx) == -2)
+        return 0;
+      uint8_t *key_buf = new uint8_t[col_trie->get_max_key_len() + 1];
+      uint32_t row_count = 0;
+      int key_len;
+      while ((key_len = col_trie->next(ctx, key_buf)) != -2) {
+        if ((size_t) key_len < prefix_len || cmn::memcmp(key_buf, prefix, prefix_len) != 0)
+          break;
+        uint32_t out_count = row_count < max_rows ? max_rows - row_count : 0;
+        row_count += get_node_rows(ctx.node_path[ctx.cur_idx], out_rows + (row_count < max_rows ? row_count : max_rows), out_count);
+      }
+      delete [] key_buf;
+      return row_count;
+    }
+
     __fq1 __fq2 void get_val_str(gen::byte_str& ret, uint32_t val_ptr, uint8_t grp_no, size_t max_valset_len) {
       uint8_t *val = grp_data[grp_no];
       ret.clear();
@@ -2051,6 +3635,19 @@ class val_ptr_group_map : public ptr_group_map {
       if (group_count == 1 || val_loc[2] == MSE_TRIE || val_loc[2] == MSE_TRIE_2WAY)
         int_ptr_bv.init(ptrs_loc, val_loc[2] == MSE_TRIE || val_loc[2] == MSE_TRIE_2WAY ? val_loc[0] : data_loc[1]);
       col_trie = col_trie_rev = nullptr;
+      delta_ckpts_loc = zone_map_loc = postings_loc = nullptr;
+      uint32_t aux_loc = cmn::read_uint32(val_loc + MDX_COL_AUX_LOC);
+      if (aux_loc != 0) {
+        uint32_t ckpts_loc = cmn::read_uint32(val_loc + aux_loc + MDX_COL_AUX_CKPTS);
+        uint32_t zones_loc = cmn::read_uint32(val_loc + aux_loc + MDX_COL_AUX_ZONES);
+        uint32_t postings_start = cmn::read_uint32(val_loc + aux_loc + MDX_COL_AUX_POSTINGS);
+        if (ckpts_loc != 0)
+          delta_ckpts_loc = val_loc + ckpts_loc;
+        if (zones_loc != 0)
+          zone_map_loc = val_loc + zones_loc;
+        if (postings_start != 0)
+          postings_loc = val_loc + postings_start;
+      }
       if (val_loc[2] == MSE_TRIE || val_loc[2] == MSE_TRIE_2WAY) {
         col_trie = new static_trie();
         col_trie->load_static_trie(val_loc + cmn::read_uint32(val_loc + 12));
@@ -2072,6 +3669,9 @@ class val_ptr_group_map : public ptr_group_map {
     __fq1 __fq2 val_ptr_group_map() {
       col_trie = nullptr;
       col_trie_rev = nullptr;
+      delta_ckpts_loc = nullptr;
+      zone_map_loc = nullptr;
+      postings_loc = nullptr;
     }
     __fq1 __fq2 virtual ~val_ptr_group_map() {
       if (col_trie != nullptr)
@@ -2106,11 +3706,19 @@ class cleanup : public cleanup_interface {
     }
 };
 
+// Once loaded, one instance can be shared by any number of threads for lookup,
+// reverse_lookup, next and get_col_val without locking. Per call state lives in
+// input_ctx, iter_ctx and caller supplied buffers; columns are initialised once on first use.
+// This holds with a fwd_cache_overlay set too, as it is updated only with atomics,
+// but set_fwd_cache_overlay() itself has to be called before the threads start.
 class static_trie_map : public static_trie {
   private:
     __fq1 __fq2 static_trie_map(static_trie_map const&);
     __fq1 __fq2 static_trie_map& operator=(static_trie_map const&);
     val_ptr_group_map *val_map;
+    uint8_t *val_map_state; // column readers are initialised on first use
+    uint8_t *val_table_loc;
+    uint64_t *tf_leaf_loc;
     uint16_t val_count;
     uint16_t pk_col_count;
     size_t max_val_len;
@@ -2120,15 +3728,46 @@ class static_trie_map : public static_trie {
     cleanup_interface *cleanup_object;
     bool is_mmapped;
     size_t trie_size;
+    size_t map_size;
+  public:
+    __fq1 __fq2 void init_val_map(size_t col_val_idx) {
+      uint8_t *val_loc = trie_bytes + cmn::read_uint64(val_table_loc + col_val_idx * sizeof(uint64_t));
+      val_map[col_val_idx].init(this, trie_loc, tf_leaf_loc + TF_LEAF, opts->inline_rank ? 8 : (opts->trie_leaf_count > 0 ? 4 : 3),
+          val_loc, key_count, node_count);
+    }
+    __fq1 __fq2 val_ptr_group_map *get_val_map(size_t col_val_idx) {
+      uint8_t *state = val_map_state + col_val_idx;
+      #ifdef __CUDA_ARCH__
+      if (*state != VAL_MAP_READY) {
+        init_val_map(col_val_idx);
+        *state = VAL_MAP_READY;
+      }
+      #else
+      if (__atomic_load_n(state, __ATOMIC_ACQUIRE) != VAL_MAP_READY) {
+        uint8_t expected = VAL_MAP_NONE;
+        if (__atomic_compare_exchange_n(state, &expected, VAL_MAP_LOADING, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+          init_val_map(col_val_idx);
+          __atomic_store_n(state, VAL_MAP_READY, __ATOMIC_RELEASE);
+        } else {
+          while (__atomic_load_n(state, __ATOMIC_ACQUIRE) != VAL_MAP_READY)
+            ; // another thread is loading this column
+        }
+      }
+      #endif
+      return val_map + col_val_idx;
+    }
   public:
     __fq1 __fq2 static_trie_map() {
       val_map = nullptr;
+      val_map_state = nullptr;
       is_mmapped = false;
       cleanup_object = nullptr;
     }
     __fq1 __fq2 ~static_trie_map() {
-      if (is_mmapped)
-        map_unmap();
+      if (val_map != nullptr) {
+        delete [] val_map;
+        delete [] val_map_state;
+      }
       if (trie_bytes != nullptr) {
         if (cleanup_object != nullptr) {
           cleanup_object->release();
@@ -2136,9 +3775,9 @@ class static_trie_map : public static_trie {
           cleanup_object = nullptr;
         }
       }
-      if (val_map != nullptr) {
-        delete [] val_map;
-      }
+      // unmapped last as column maps refer to the mapped bytes
+      if (is_mmapped)
+        map_unmap();
     }
 
     __fq1 __fq2 void set_cleanup_object(cleanup_interface *_cleanup_obj) {
@@ -2149,7 +3788,7 @@ class static_trie_map : public static_trie {
       bool is_found = lookup(in_ctx);
       if (is_found) {
         if (val_count > 1)
-          val_map[1].get_val(in_ctx.node_id, in_size_out_value_len, val);
+          get_val_map(1)->get_val(in_ctx.node_id, in_size_out_value_len, val);
         return true;
       }
       return false;
@@ -2159,10 +3798,98 @@ class static_trie_map : public static_trie {
       if (col_val_idx < pk_col_count) { // TODO: Extract from composite keys,Convert numbers back
         return reverse_lookup_from_node_id(node_id, in_size_out_value_len, (uint8_t *) val);
       }
-      val_map[col_val_idx].get_val(node_id, in_size_out_value_len, val, p_ptr_bit_count);
+      get_val_map(col_val_idx)->get_val(node_id, in_size_out_value_len, val, p_ptr_bit_count);
+      return true;
+    }
+
+    // Bulk decode of a numeric column, see val_ptr_group_map::decode_range()
+    __fq1 __fq2 uint32_t decode_range(int col_val_idx, uint32_t start_row, uint32_t count, void *out_vals, uint64_t *null_bm = nullptr) {
+      if (col_val_idx < pk_col_count)
+        return 0;
+      return get_val_map(col_val_idx)->decode_range(start_row, count, out_vals, null_bm);
+    }
+
+    // Sum, min, max, count and null count of count rows of a numeric column
+    // from start_row, all rows by default. Returns false for other columns.
+    __fq1 __fq2 bool aggregate(int col_val_idx, col_agg& agg, uint32_t start_row = 0, uint32_t count = UINT32_MAX) {
+      if (col_val_idx < pk_col_count)
+        return false;
+      val_ptr_group_map *vm = get_val_map(col_val_idx);
+      agg.reset(vm->data_type);
+      if (vm->data_type == MST_TEXT || vm->data_type == MST_BIN)
+        return false;
+      vm->aggregate(start_row, count, agg);
       return true;
     }
 
+    // Calls match_fn(uint32_t row, int64_t val) for rows of a numeric column with
+    // lo <= val <= hi, in stored form (decimals scaled by 10^n). match_fn returns
+    // false to stop. Returns the number of matches, using zone maps when present.
+    template <typename T>
+    __fq1 __fq2 uint32_t scan_where(int col_val_idx, int64_t lo, int64_t hi, T match_fn) {
+      if (col_val_idx < pk_col_count)
+        return 0;
+      return get_val_map(col_val_idx)->scan_where(lo, hi, match_fn);
+    }
+
+    // Text column filters. Write the matching row ids (leaf ids, or node ids when
+    // there are no keys) among count rows from start_row to sel_vec, which needs
+    // room for count ids, and return how many matched. Pass the same memo when
+    // filtering a column a block of rows at a time, see filter_memo.
+    __fq1 __fq2 uint32_t filter_eq(int col_val_idx, const uint8_t *val, size_t val_len, uint32_t *sel_vec,
+                uint32_t start_row = 0, uint32_t count = UINT32_MAX, filter_memo *memo = nullptr) {
+      text_eq_pred pred = {val, val_len};
+      return filter_text(col_val_idx, pred, sel_vec, start_row, count, memo);
+    }
+    __fq1 __fq2 uint32_t filter_prefix(int col_val_idx, const uint8_t *prefix, size_t prefix_len, uint32_t *sel_vec,
+                uint32_t start_row = 0, uint32_t count = UINT32_MAX, filter_memo *memo = nullptr) {
+      text_prefix_pred pred = {prefix, prefix_len};
+      return filter_text(col_val_idx, pred, sel_vec, start_row, count, memo);
+    }
+    __fq1 __fq2 uint32_t filter_in(int col_val_idx, const uint8_t **vals, const size_t *val_lens, size_t val_count,
+                uint32_t *sel_vec, uint32_t start_row = 0, uint32_t count = UINT32_MAX, filter_memo *memo = nullptr) {
+      text_in_pred pred = {vals, val_lens, val_count};
+      return filter_text(col_val_idx, pred, sel_vec, start_row, count, memo);
+    }
+    template <typename T>
+    __fq1 __fq2 uint32_t filter_text(int col_val_idx, T& pred_fn, uint32_t *sel_vec, uint32_t start_row, uint32_t count,
+                filter_memo *memo = nullptr) {
+      if (col_val_idx < pk_col_count)
+        return 0;
+      return get_val_map(col_val_idx)->filter_text(start_row, count, pred_fn, sel_vec, memo);
+    }
+
+    // Row ids (leaf ids, or node ids when there are no keys) of an MSE_TRIE_2WAY
+    // column having the value val or a value starting with prefix. Up to max_rows
+    // ids are written to out_rows and the total count is returned.
+    __fq1 __fq2 uint32_t get_value_rows(int col_val_idx, const uint8_t *val, size_t val_len,
+                uint32_t *out_rows, uint32_t max_rows) {
+      if (col_val_idx < pk_col_count)
+        return 0;
+      return get_val_map(col_val_idx)->get_value_rows(val, val_len, out_rows, max_rows);
+    }
+    __fq1 __fq2 uint32_t get_prefix_rows(int col_val_idx, const uint8_t *prefix, size_t prefix_len,
+                uint32_t *out_rows, uint32_t max_rows) {
+      if (col_val_idx < pk_col_count)
+        return 0;
+      return get_val_map(col_val_idx)->get_prefix_rows(prefix, prefix_len, out_rows, max_rows);
+    }
+
+    // Reads a numeric column row after row from start_row, carrying the running
+    // sum of delta encoded columns instead of summing from a checkpoint per row
+    __fq1 __fq2 void init_col_iter(int col_val_idx, uint32_t start_row, col_iter_ctx& ctx) {
+      ctx.col_val_idx = col_val_idx;
+      if (col_val_idx >= pk_col_count)
+        get_val_map(col_val_idx)->init_iter(ctx, start_row);
+    }
+
+    // Returns false after the last row. Null values have length 0
+    __fq1 __fq2 bool next_col_val(col_iter_ctx& ctx, size_t *out_value_len, void *val) {
+      if (ctx.col_val_idx < pk_col_count)
+        return false;
+      return get_val_map(ctx.col_val_idx)->iter_next(ctx, out_value_len, val);
+    }
+
     __fq1 __fq2 const char *get_table_name() {
       return names_start + cmn::read_uint16(names_loc);
     }
@@ -2192,15 +3919,15 @@ class static_trie_map : public static_trie {
     }
 
     __fq1 __fq2 uint32_t get_max_val_len(int col_val_idx) {
-      return val_map[col_val_idx].max_len;
+      return get_val_map(col_val_idx)->max_len;
     }
 
     __fq1 __fq2 static_trie *get_col_trie(int col_val_idx) {
-      return val_map[col_val_idx].get_col_trie();
+      return get_val_map(col_val_idx)->get_col_trie();
     }
 
     __fq1 __fq2 static_trie *get_col_trie_rev(int col_val_idx) {
-      return val_map[col_val_idx].get_col_trie_rev();
+      return get_val_map(col_val_idx)->get_col_trie_rev();
     }
 
     __fq1 __fq2 uint16_t get_column_count() {
@@ -2215,7 +3942,7 @@ class static_trie_map : public static_trie {
       gen::is_gen_print_enabled = to_print_messages;
     }
 
-    __fq1 __fq2 uint8_t *map_file(const char *filename, off_t& sz) {
+    __fq1 __fq2 uint8_t *map_file(const char *filename, off_t& sz, int map_policy = MDX_MAP_NONE) {
 #ifdef _WIN32
       load(filename);
       return trie_bytes;
@@ -2234,32 +3961,121 @@ class static_trie_map : public static_trie {
         close(fd);
         return nullptr;
       }
+      map_size = sz;
+      if (map_policy & MDX_MAP_HUGEPAGE_COPY) {
+        uint8_t *hp_buf = copy_core_to_hugepages(map_buf, sz, fd);
+        if (hp_buf != nullptr) {
+          munmap(map_buf, sz);
+          map_buf = hp_buf;
+        }
+      }
       close(fd);
       return map_buf;
 #endif
     }
 
-    __fq1 __fq2 void map_file_to_mem(const char *filename) {
+#ifndef _WIN32
+    // End of caches, rank/select lts and trie_flags, which are laid out
+    // one after the other from the fwd cache, followed by tail ptrs data
+    __fq1 __fq2 static uint64_t get_core_end(uint8_t *bytes, size_t sz) {
+      uint64_t core_end = cmn::read_hdr_loc(bytes, 104);
+      return core_end > sz ? sz : core_end;
+    }
+
+    __fq1 __fq2 static void advise(uint8_t *from, uint8_t *to, int advice) {
+      size_t page_size = sysconf(_SC_PAGESIZE);
+      uint8_t *start = (uint8_t *) ((uintptr_t) from & ~(page_size - 1));
+      if (to > start && madvise(start, to - start, advice) != 0)
+        perror("madvise: ");
+    }
+
+    // Copies the trie core to 2 MB aligned anonymous memory backed by hugepages
+    // and maps the rest of the file right after it, so offsets stay the same
+    __fq1 __fq2 uint8_t *copy_core_to_hugepages(uint8_t *map_buf, size_t sz, int fd) {
+      size_t core_len = get_core_end(map_buf, sz);
+      core_len = (core_len + MDX_HUGEPAGE_SIZE - 1) & ~((size_t) MDX_HUGEPAGE_SIZE - 1);
+      if (core_len > sz)
+        core_len = sz;
+      size_t map_len = (sz + MDX_HUGEPAGE_SIZE - 1) & ~((size_t) MDX_HUGEPAGE_SIZE - 1);
+      uint8_t *reserved = (uint8_t *) mmap(0, map_len + MDX_HUGEPAGE_SIZE, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (reserved == MAP_FAILED) {
+        perror("mmap hugepages: ");
+        return nullptr;
+      }
+      uint8_t *hp_buf = (uint8_t *) (((uintptr_t) reserved + MDX_HUGEPAGE_SIZE - 1) & ~((uintptr_t) MDX_HUGEPAGE_SIZE - 1));
+      if (hp_buf > reserved)
+        munmap(reserved, hp_buf - reserved);
+      munmap(hp_buf + map_len, reserved + MDX_HUGEPAGE_SIZE - hp_buf);
+      #ifdef MADV_HUGEPAGE
+      madvise(hp_buf, core_len, MADV_HUGEPAGE);
+      #endif
+      memcpy(hp_buf, map_buf, core_len);
+      mprotect(hp_buf, core_len, PROT_READ);
+      if (core_len < sz) {
+        // the rest stays file backed
+        if (mmap(hp_buf + core_len, sz - core_len, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, core_len) == MAP_FAILED) {
+          perror("mmap remainder: ");
+          munmap(hp_buf, map_len);
+          return nullptr;
+        }
+      }
+      map_size = map_len;
+      return hp_buf;
+    }
+
+    __fq1 __fq2 void apply_map_policy(size_t sz, int map_policy) {
+      uint8_t *core_start = trie_bytes + cmn::read_hdr_loc(trie_bytes, 64);
+      uint8_t *core_end = trie_bytes + get_core_end(trie_bytes, sz);
+      if (map_policy & MDX_MAP_WILLNEED)
+        advise(core_start, core_end, MADV_WILLNEED);
+      if ((map_policy & MDX_MAP_MLOCK) && core_end > core_start) {
+        if (mlock(core_start, core_end - core_start) != 0)
+          perror("mlock: ");
+      }
+      #ifdef MADV_HUGEPAGE
+      if ((map_policy & MDX_MAP_HUGEPAGE) && !(map_policy & MDX_MAP_HUGEPAGE_COPY))
+        advise(trie_bytes, core_end, MADV_HUGEPAGE);
+      #endif
+      if (map_policy & MDX_MAP_RANDOM_VALS) {
+        uint32_t col_count = cmn::read_uint32(trie_bytes + 4);
+        uint8_t *val_tbl = trie_bytes + cmn::read_hdr_loc(trie_bytes, 12);
+        uint64_t vals_start = sz;
+        for (size_t i = 0; i < col_count; i++) {
+          uint64_t val_loc = cmn::read_uint64(val_tbl + i * sizeof(uint64_t));
+          if (val_loc > 0 && val_loc < vals_start)
+            vals_start = val_loc;
+        }
+        // start at the next page so the index tail keeps its readahead
+        size_t page_size = sysconf(_SC_PAGESIZE);
+        vals_start = (vals_start + page_size - 1) & ~(page_size - 1);
+        if (vals_start < sz)
+          advise(trie_bytes + vals_start, trie_bytes + sz, MADV_RANDOM);
+      }
+    }
+#endif
+
+    __fq1 __fq2 bool map_file_to_mem(const char *filename, int map_policy = MDX_MAP_NONE) {
       off_t dict_size;
-      trie_bytes = map_file(filename, dict_size);
-      //       int len_will_need = (dict_size >> 2);
-      //       //madvise(trie_bytes, len_will_need, MADV_WILLNEED);
-      // #ifndef _WIN32
-      //       mlock(trie_bytes, len_will_need);
-      // #endif
+      trie_bytes = map_file(filename, dict_size, map_policy);
+      if (trie_bytes == nullptr)
+        return false;
+      trie_size = dict_size;
+      #ifndef _WIN32
+      if (trie_bytes != nullptr && map_policy != MDX_MAP_NONE)
+        apply_map_policy(dict_size, map_policy);
+      #endif
       load_into_vars();
       is_mmapped = true;
+      return true;
     }
 
     __fq1 __fq2 void map_unmap() {
-      // #ifndef _WIN32
-      //       munlock(trie_bytes, dict_size >> 2);
-      //       int err = munmap(trie_bytes, dict_size);
-      //       if(err != 0){
-      //         printf("UnMapping trie_bytes Failed\n");
-      //         return;
-      //       }
-      // #endif
+      #ifndef _WIN32
+      // also releases any mlock and the hugepage copy of the core
+      if (trie_bytes != nullptr && munmap(trie_bytes, map_size) != 0)
+        perror("munmap: ");
+      #endif
       trie_bytes = nullptr;
       is_mmapped = false;
     }
@@ -2281,9 +4097,11 @@ class static_trie_map : public static_trie {
       struct stat file_stat;
       memset(&file_stat, 0, sizeof(file_stat));
       stat(filename, &file_stat);
-      trie_bytes = new uint8_t[file_stat.st_size];
+      // aligned to 64 so that trie_flags blocks with inline ranks stay within cache lines
+      uint8_t *alloc_bytes = new uint8_t[file_stat.st_size + 63];
+      trie_bytes = alloc_bytes + ((64 - ((uintptr_t) alloc_bytes % 64)) % 64);
       cleanup_object = new cleanup();
-      ((cleanup *)cleanup_object)->init(trie_bytes);
+      ((cleanup *)cleanup_object)->init(alloc_bytes);
 
       FILE *fp = fopen(filename, "rb");
       if (fp == nullptr) {
@@ -2321,29 +4139,154 @@ class static_trie_map : public static_trie {
       val_count = cmn::read_uint32(trie_bytes + 4);
       max_val_len = cmn::read_uint32(trie_bytes + 36);
 
-      uint64_t *tf_leaf_loc = (uint64_t *) (trie_bytes + cmn::read_uint32(trie_bytes + 116));
+      tf_leaf_loc = (uint64_t *) (trie_bytes + cmn::read_hdr_loc(trie_bytes, 116));
 
-      names_loc = trie_bytes + cmn::read_uint32(trie_bytes + 8);
-      uint8_t *val_table_loc = trie_bytes + cmn::read_uint32(trie_bytes + 12);
+      names_loc = trie_bytes + cmn::read_hdr_loc(trie_bytes, 8);
+      val_table_loc = trie_bytes + cmn::read_hdr_loc(trie_bytes, 12);
       names_start = (char *) names_loc + (val_count + 2) * sizeof(uint16_t);
       column_encoding = names_start + cmn::read_uint16(names_loc);
 
       val_map = nullptr;
+      val_map_state = nullptr;
       pk_col_count = 0;
       if (val_count > 0) {
         val_map = new val_ptr_group_map[val_count]();
+        val_map_state = new uint8_t[val_count]();
         for (size_t i = 0; i < val_count; i++) {
-          uint64_t vl64 = cmn::read_uint64(val_table_loc + i * sizeof(uint64_t));
-          uint8_t *val_loc = trie_bytes + vl64;
-          if (val_loc == trie_bytes) {
+          if (cmn::read_uint64(val_table_loc + i * sizeof(uint64_t)) == 0) {
             pk_col_count++;
-            continue;
+            val_map_state[i] = VAL_MAP_READY;
           }
-          val_map[i].init(this, trie_loc, tf_leaf_loc + TF_LEAF, opts->trie_leaf_count > 0 ? 4 : 3, val_loc, key_count, node_count);
         }
       }
     }
 };
 
+#ifndef __CUDA_ARCH__
+#define MDX_HANDLE_MAX_READERS 128
+
+// Holds the current static_trie_map and replaces it under live readers.
+// Each reader thread takes a slot with register_reader() and brackets its queries
+// with acquire() and release(). A replaced trie is deleted (and unmapped) once
+// every reader inside acquire()/release() entered after it was replaced.
+// reload() and publish() are expected to be called from one writer thread.
+// A fwd_cache_overlay belongs to one trie, as it holds its node ids. Give
+// each published trie its own one; publish() detaches it if it is shared.
+class trie_handle {
+  private:
+    trie_handle(trie_handle const&);
+    trie_handle& operator=(trie_handle const&);
+    struct reader_slot {
+      uint64_t epoch; // 0 when outside acquire()/release()
+      uint8_t in_use;
+      uint8_t padding[64 - sizeof(uint64_t) - 1];
+    };
+    struct retired_trie {
+      static_trie_map *trie;
+      uint64_t epoch;
+    };
+    static_trie_map *current;
+    uint64_t global_epoch;
+    reader_slot *slots;
+    size_t slot_count;
+    std::vector<retired_trie> retired;
+  public:
+    trie_handle(size_t max_readers = MDX_HANDLE_MAX_READERS) {
+      current = nullptr;
+      global_epoch = 1;
+      slot_count = max_readers;
+      slots = new reader_slot[slot_count]();
+    }
+    ~trie_handle() {
+      // no readers are expected at this point
+      for (size_t i = 0; i < retired.size(); i++)
+        delete retired[i].trie;
+      if (current != nullptr)
+        delete current;
+      delete [] slots;
+    }
+
+    // Returns -1 if all max_readers slots are taken. The caller has to
+    // handle it, acquire() returns nullptr for that slot.
+    int register_reader() {
+      for (size_t i = 0; i < slot_count; i++) {
+        uint8_t expected = 0;
+        if (__atomic_compare_exchange_n(&slots[i].in_use, &expected, 1, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+          return i;
+      }
+      return -1;
+    }
+    void unregister_reader(int slot) {
+      if (slot < 0)
+        return;
+      __atomic_store_n(&slots[slot].epoch, 0, __ATOMIC_SEQ_CST);
+      __atomic_store_n(&slots[slot].in_use, 0, __ATOMIC_RELEASE);
+    }
+
+    // The returned trie stays valid until release() on the same slot
+    static_trie_map *acquire(int slot) {
+      if (slot < 0)
+        return nullptr;
+      __atomic_store_n(&slots[slot].epoch, __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+      return __atomic_load_n(&current, __ATOMIC_SEQ_CST);
+    }
+    void release(int slot) {
+      if (slot < 0)
+        return;
+      __atomic_store_n(&slots[slot].epoch, 0, __ATOMIC_RELEASE);
+    }
+
+    bool reload(const char *filename, int map_policy = MDX_MAP_NONE) {
+      static_trie_map *new_trie = new static_trie_map();
+      if (!new_trie->map_file_to_mem(filename, map_policy)) {
+        delete new_trie;
+        return false;
+      }
+      publish(new_trie);
+      return true;
+    }
+
+    // Takes ownership of new_trie
+    void publish(static_trie_map *new_trie) {
+      static_trie_map *cur_trie = __atomic_load_n(&current, __ATOMIC_SEQ_CST);
+      if (cur_trie != nullptr && new_trie->get_fwd_cache_overlay() == cur_trie->get_fwd_cache_overlay())
+        new_trie->set_fwd_cache_overlay(nullptr);
+      static_trie_map *old_trie = __atomic_exchange_n(&current, new_trie, __ATOMIC_SEQ_CST);
+      if (old_trie != nullptr) {
+        retired_trie rt;
+        rt.trie = old_trie;
+        rt.epoch = __atomic_add_fetch(&global_epoch, 1, __ATOMIC_SEQ_CST);
+        retired.push_back(rt);
+      }
+      reclaim();
+    }
+
+    // Deletes retired tries no reader can still be using, returns how many remain
+    size_t reclaim() {
+      uint64_t min_epoch = UINT64_MAX;
+      for (size_t i = 0; i < slot_count; i++) {
+        uint64_t epoch = __atomic_load_n(&slots[i].epoch, __ATOMIC_SEQ_CST);
+        if (epoch != 0 && epoch < min_epoch)
+          min_epoch = epoch;
+      }
+      size_t remaining = 0;
+      for (size_t i = 0; i < retired.size(); i++) {
+        if (retired[i].epoch <= min_epoch)
+          delete retired[i].trie;
+        else
+          retired[remaining++] = retired[i];
+      }
+      retired.resize(remaining);
+      return remaining;
+    }
+
+    // Waits until all replaced tries are released
+    void synchronize() {
+      while (reclaim() > 0)
+        usleep(100);
+    }
+};
+#endif
+
 }
 #endif